@@ -31,7 +31,63 @@ public:
     YankNext,
     SaveCurrentBuffer,
     CommentOutRegion,
-    UncommentRegion
+    UncommentRegion,
+    DabbrevExpand,
+    HippieExpand,
+    ForwardWord,
+    BackwardWord,
+    KillWord,
+    BackwardKillWord,
+    ForwardParagraph,
+    BackwardParagraph,
+    MarkParagraph,
+    KillParagraph,
+    ForwardSexp,
+    BackwardSexp,
+    BackwardUpList,
+    KillSexp,
+    GotoLine,
+    GotoChar,
+    MoveToColumn,
+    ScrollUp,
+    ScrollDown,
+    RecenterTopBottom,
+    DigitArgument,
+    NegativeArgument,
+    UniversalArgument,
+    ZapToChar,
+    ZapUpToChar,
+    JumpToChar,
+    CommentDwim,
+    KillRectangle,
+    YankRectangle,
+    StringRectangle,
+    OpenRectangle,
+    ClearRectangle,
+    KeyboardQuit,
+    FillParagraph,
+    SetFillColumn,
+    DeleteTrailingWhitespace,
+    Untabify,
+    Tabify,
+    WhitespaceCleanup,
+    SortLines,
+    SortNumericLines,
+    ReverseRegion,
+    DeleteDuplicateLines,
+    NarrowToRegion,
+    Widen,
+    SelfInsert,
+    DeleteChar,
+    StartMacro,
+    EndMacro,
+    CallMacro,
+    ApplyMacroToRegionLines,
+    BroadcastToRegionLines,
+    ShellCommandOnRegion,
+    SaveSomeBuffers,
+    RecoverThisFile,
+    FindFile
   };
 
 private:
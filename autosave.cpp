@@ -0,0 +1,297 @@
+/**************************************************************************
+**
+** Copyright (c) 2014 Siarhei Rachytski (siarhei.rachytski@gmail.com)
+**
+** GNU Lesser General Public License Usage
+**
+** This file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+
+#include "autosave.hpp"
+#include "documentwriter.hpp"
+#include "emacsmodesettings.hpp"
+
+#include <QtConcurrent/QtConcurrentRun>
+#include <QtCore/QCoreApplication>
+#include <QtCore/QDataStream>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QSaveFile>
+#include <QtGui/QTextCursor>
+#include <QtGui/QTextDocument>
+
+#include <cstring>
+#include <vector>
+
+namespace EmacsMode {
+namespace Internal {
+
+// Milliseconds from the first unsaved edit to the auto-save.
+static const int AutoSaveDelay = 5000;
+
+// The journal is compacted when it is this many times the size of a
+// snapshot of the text, but never below the minimum.
+static const int CompactionRatio = 2;
+static const qint64 MinCompactionBytes = 256 * 1024;
+
+static const char JournalMagic[] = "EMJ2";
+static const quint8 SnapshotRecord = 'S';
+static const quint8 EditRecord = 'D';
+
+AutoSaveJournal::AutoSaveJournal(QTextDocument *document)
+  : QObject(document)
+  , document_(document)
+  , length_(document->characterCount() - 1)
+{
+  timer_.setSingleShot(true);
+  timer_.setInterval(AutoSaveDelay);
+  connect(&timer_, SIGNAL(timeout()), SLOT(flush()));
+  connect(document, SIGNAL(contentsChange(int,int,int)),
+          SLOT(onContentsChanged(int,int,int)));
+}
+
+AutoSaveJournal *AutoSaveJournal::forDocument(QTextDocument *document)
+{
+  AutoSaveJournal *journal = document->findChild<AutoSaveJournal *>(QString(), Qt::FindDirectChildrenOnly);
+  if (!journal)
+    journal = new AutoSaveJournal(document);
+  return journal;
+}
+
+QString AutoSaveJournal::journalName(const QString &fileName)
+{
+  const QFileInfo fileInfo(fileName);
+  return fileInfo.dir().filePath(QLatin1Char('#') + fileInfo.fileName() + QLatin1Char('#'));
+}
+
+void AutoSaveJournal::setFileName(const QString &fileName)
+{
+  const QString name = fileName.isEmpty() ? QString() : journalName(fileName);
+  if (name == journalName_)
+    return;
+  journalName_ = name;
+  pending_.clear();
+  hasSnapshot_ = false;
+  removeJournal_ = false;
+  journalBytes_ = 0;
+  backedUp_ = false;
+}
+
+void AutoSaveJournal::discard()
+{
+  pending_.clear();
+  hasSnapshot_ = false;
+  journalBytes_ = 0;
+  removeJournal_ = true;
+  timer_.start();
+}
+
+// The removed and added counts may include the paragraph separator Qt
+// keeps after the last block, which the journal's text does not have.
+void AutoSaveJournal::onContentsChanged(int position, int charsRemoved, int charsAdded)
+{
+  position = qMin<qint64>(position, length_);
+  const qint64 removed = qMin<qint64>(charsRemoved, length_ - position);
+  const int end = qMin(position + charsAdded, document_->characterCount() - 1);
+  length_ += end - position - removed;
+
+  if (journalName_.isEmpty() || !theEmacsModeSetting(ConfigAutoSave)->value().toBool())
+    return;
+
+  // edits before the first snapshot are part of it
+  if (hasSnapshot_) {
+    QTextCursor cursor(document_);
+    cursor.setPosition(position);
+    cursor.setPosition(end, QTextCursor::KeepAnchor);
+    QString added = cursor.selectedText();
+    added.replace(QChar::ParagraphSeparator, QLatin1Char('\n'));
+
+    QDataStream stream(&pending_, QIODevice::WriteOnly | QIODevice::Append);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << EditRecord << qint64(position) << removed << added;
+  }
+  if (!timer_.isActive())
+    timer_.start();
+}
+
+void AutoSaveJournal::flushAndWait()
+{
+  write_.waitForFinished();
+  timer_.stop();
+  flush();
+  write_.waitForFinished();
+}
+
+void AutoSaveJournal::flush()
+{
+  // one write at a time, so the journal's records stay in order
+  if (!write_.isFinished()) {
+    timer_.start();
+    return;
+  }
+  if (journalName_.isEmpty())
+    return;
+
+  const QString journal = journalName_;
+  if (!document_->isModified() || !theEmacsModeSetting(ConfigAutoSave)->value().toBool()) {
+    if (hasSnapshot_)
+      removeJournal_ = true;
+    pending_.clear();
+    hasSnapshot_ = false;
+    journalBytes_ = 0;
+    if (removeJournal_) {
+      removeJournal_ = false;
+      write_ = QtConcurrent::run([journal]() { QFile::remove(journal); });
+    }
+    return;
+  }
+  removeJournal_ = false;
+
+  const qint64 snapshotBytes = 2 * length_;
+  if (hasSnapshot_ && journalBytes_ + pending_.size()
+      > qMax(MinCompactionBytes, CompactionRatio * snapshotBytes))
+    hasSnapshot_ = false;
+
+  if (!hasSnapshot_) {
+    const QString text = documentText(document_);
+    pending_.clear();
+    hasSnapshot_ = true;
+    journalBytes_ = snapshotBytes;
+    write_ = QtConcurrent::run([journal, text]() {
+      QString snapshot = text;
+      snapshot.replace(QChar::ParagraphSeparator, QLatin1Char('\n'));
+      QSaveFile file(journal);
+      if (!file.open(QIODevice::WriteOnly))
+        return;
+      QDataStream stream(&file);
+      stream.setVersion(QDataStream::Qt_5_0);
+      stream.writeRawData(JournalMagic, 4);
+      stream << SnapshotRecord << snapshot;
+      file.commit();
+    });
+    return;
+  }
+
+  if (pending_.isEmpty())
+    return;
+  const QByteArray edits = pending_;
+  pending_.clear();
+  journalBytes_ += edits.size();
+  write_ = QtConcurrent::run([journal, edits]() {
+    QFile file(journal);
+    if (file.open(QIODevice::WriteOnly | QIODevice::Append))
+      file.write(edits);
+  });
+}
+
+// Text with a gap at the last edit, so that the mostly nearby edits of
+// a journal move little of it.
+class GapBuffer
+{
+public:
+  explicit GapBuffer(const QString &text)
+    : chars_(text.constData(), text.constData() + text.size())
+    , gapBegin_(text.size())
+    , gapEnd_(text.size())
+  {
+  }
+
+  qint64 size() const { return qint64(chars_.size()) - (gapEnd_ - gapBegin_); }
+
+  void replace(qint64 position, qint64 removed, const QString &added)
+  {
+    moveGap(position);
+    gapEnd_ += removed;
+    if (gapEnd_ - gapBegin_ < added.size()) {
+      const size_t grow = added.size() + chars_.size() / 2;
+      chars_.insert(chars_.begin() + gapEnd_, grow, QChar());
+      gapEnd_ += grow;
+    }
+    std::copy(added.constData(), added.constData() + added.size(), chars_.begin() + gapBegin_);
+    gapBegin_ += added.size();
+  }
+
+  QString text() const
+  {
+    QString text;
+    text.reserve(size());
+    text.append(chars_.data(), int(gapBegin_));
+    text.append(chars_.data() + gapEnd_, int(chars_.size() - gapEnd_));
+    return text;
+  }
+
+private:
+  void moveGap(qint64 position)
+  {
+    if (position < gapBegin_) {
+      std::copy_backward(chars_.begin() + position, chars_.begin() + gapBegin_,
+                         chars_.begin() + gapEnd_);
+    } else if (position > gapBegin_) {
+      std::copy(chars_.begin() + gapEnd_, chars_.begin() + gapEnd_ + (position - gapBegin_),
+                chars_.begin() + gapBegin_);
+    }
+    gapEnd_ += position - gapBegin_;
+    gapBegin_ = position;
+  }
+
+  std::vector<QChar> chars_;
+  qint64 gapBegin_;
+  qint64 gapEnd_;
+};
+
+bool AutoSaveJournal::replay(const QString &journalName, QString *text, QString *error)
+{
+  QFile file(journalName);
+  if (!file.open(QIODevice::ReadOnly)) {
+    *error = QCoreApplication::translate("EmacsMode::Internal", "Cannot read auto-save file '%1': %2")
+        .arg(journalName, file.errorString());
+    return false;
+  }
+
+  QDataStream stream(&file);
+  stream.setVersion(QDataStream::Qt_5_0);
+  char magic[4];
+  quint8 type = 0;
+  QString snapshot;
+  if (stream.readRawData(magic, 4) == 4 && memcmp(magic, JournalMagic, 4) == 0)
+    stream >> type;
+  if (type == SnapshotRecord)
+    stream >> snapshot;
+  if (type != SnapshotRecord || stream.status() != QDataStream::Ok) {
+    *error = QCoreApplication::translate("EmacsMode::Internal", "'%1' is not an auto-save file")
+        .arg(journalName);
+    return false;
+  }
+
+  GapBuffer buffer(snapshot);
+  snapshot.clear();
+
+  // a record cut short by a crash ends the journal
+  while (!stream.atEnd()) {
+    qint64 position = 0;
+    qint64 removed = 0;
+    QString added;
+    stream >> type >> position >> removed >> added;
+    if (stream.status() != QDataStream::Ok)
+      break;
+    if (type != EditRecord || position < 0 || removed < 0 || position + removed > buffer.size()) {
+      *error = QCoreApplication::translate("EmacsMode::Internal", "Auto-save file '%1' is damaged")
+          .arg(journalName);
+      return false;
+    }
+    buffer.replace(position, removed, added);
+  }
+  *text = buffer.text();
+  return true;
+}
+
+}
+}
@@ -0,0 +1,91 @@
+/**************************************************************************
+**
+** Copyright (c) 2014 Siarhei Rachytski (siarhei.rachytski@gmail.com)
+**
+** GNU Lesser General Public License Usage
+**
+** This file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+
+#pragma once
+
+#include <QtCore/QByteArray>
+#include <QtCore/QFuture>
+#include <QtCore/QObject>
+#include <QtCore/QString>
+#include <QtCore/QTimer>
+
+class QTextDocument;
+
+namespace EmacsMode {
+namespace Internal {
+
+struct RecoveredText
+{
+  QString text_;
+  QString error_; // empty on success
+};
+
+// The auto-save file of a document, #name# next to the file. It starts
+// with a snapshot of the text and grows by the edits made since, which
+// are collected from contentsChange and appended every few seconds, so
+// an auto-save costs about as much as the edits it records. Once the
+// edits outweigh the text the journal is compacted into a new snapshot.
+// All file access happens on a worker thread.
+class AutoSaveJournal : public QObject
+{
+  Q_OBJECT
+
+public:
+  // the journal of document, created on first use and shared by all its editors
+  static AutoSaveJournal *forDocument(QTextDocument *document);
+
+  static QString journalName(const QString &fileName);
+
+  void setFileName(const QString &fileName);
+
+  // The file now holds everything recorded so far, the journal is
+  // removed.
+  void discard();
+
+  // Writes what has been recorded without waiting for the timer and
+  // returns once it is on disk.
+  void flushAndWait();
+
+  // Whether file~ was made for the current file name. It is made once,
+  // by the first save that finds an old file to copy.
+  bool isBackedUp() const { return backedUp_; }
+  void setBackedUp() { backedUp_ = true; }
+
+  // Rebuilds the text from a journal, reading and replaying it in the
+  // calling thread. Returns false and sets error if it is unreadable.
+  static bool replay(const QString &journalName, QString *text, QString *error);
+
+private slots:
+  void onContentsChanged(int position, int charsRemoved, int charsAdded);
+  void flush();
+
+private:
+  explicit AutoSaveJournal(QTextDocument *document);
+
+  QTextDocument *document_;
+  QString journalName_; // empty while the document has no file
+  QTimer timer_;
+  QByteArray pending_;      // edits not written yet
+  qint64 length_ = 0;       // of the text the edits apply to
+  qint64 journalBytes_ = 0; // written so far
+  bool hasSnapshot_ = false;
+  bool removeJournal_ = false;
+  bool backedUp_ = false;
+  QFuture<void> write_;
+};
+
+}
+}
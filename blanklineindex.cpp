@@ -0,0 +1,166 @@
+/**************************************************************************
+**
+** Copyright (c) 2014 Siarhei Rachytski (siarhei.rachytski@gmail.com)
+**
+** GNU Lesser General Public License Usage
+**
+** This file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+
+#include "blanklineindex.hpp"
+#include "blockchange.hpp"
+#include "textscan.hpp"
+
+#include <QtCore/qalgorithms.h>
+#include <QtGui/QTextBlock>
+#include <QtGui/QTextDocument>
+
+namespace EmacsMode {
+namespace Internal {
+
+static const int WordBits = 64;
+
+static int wordCount(int bits)
+{
+  return (bits + WordBits - 1) / WordBits;
+}
+
+void BlankLineIndex::setDocument(QTextDocument *document)
+{
+  document_ = document;
+  clear();
+}
+
+void BlankLineIndex::clear()
+{
+  built_ = false;
+  size_ = 0;
+  words_.clear();
+}
+
+void BlankLineIndex::build()
+{
+  clear();
+  if (!document_)
+    return;
+
+  size_ = document_->blockCount();
+  words_.assign(wordCount(size_), 0);
+  int i = 0;
+  for (QTextBlock block = document_->begin(); block.isValid(); block = block.next())
+    assign(i++, isBlank(block.text()));
+  built_ = true;
+}
+
+void BlankLineIndex::update(const BlockChange &change)
+{
+  if (!built_)
+    return;
+
+  if (!change.isValid() || change.firstBlock_ + change.removedBlocks_ > size_) {
+    clear();
+    return;
+  }
+
+  const int delta = change.addedBlocks_ - change.removedBlocks_;
+  if (delta != 0) {
+    // shift the tail behind the edited blocks, a word at a time
+    const int tail = change.firstBlock_ + change.removedBlocks_;
+    const int newSize = size_ + delta;
+    std::vector<quint64> words(wordCount(newSize), 0);
+    for (int w = 0; w < wordCount(change.firstBlock_); ++w)
+      words[w] = words_[w];
+    if (change.firstBlock_ % WordBits)
+      words[change.firstBlock_ / WordBits] &= (quint64(1) << (change.firstBlock_ % WordBits)) - 1;
+
+    int bit = tail + delta;
+    for (; bit < newSize && bit % WordBits; ++bit)
+      if (test(bit - delta))
+        words[bit / WordBits] |= quint64(1) << (bit % WordBits);
+    for (; bit < newSize; bit += WordBits)
+      words[bit / WordBits] = wordAt(bit - delta);
+
+    words_.swap(words);
+    size_ = newSize;
+    if (size_ % WordBits)
+      words_.back() &= (quint64(1) << (size_ % WordBits)) - 1;
+  }
+
+  QTextBlock block = document_->findBlockByNumber(change.firstBlock_);
+  for (int i = 0; i < change.addedBlocks_ && block.isValid(); ++i, block = block.next())
+    assign(change.firstBlock_ + i, isBlank(block.text()));
+
+  if (size_ != document_->blockCount())
+    clear();
+}
+
+int BlankLineIndex::findForward(int block, bool blank)
+{
+  if (!built_)
+    build();
+  if (block < 0)
+    block = 0;
+
+  for (int w = block / WordBits; w < int(words_.size()); ++w) {
+    quint64 bits = blank ? words_[w] : ~words_[w];
+    if (w == block / WordBits)
+      bits &= ~quint64(0) << (block % WordBits);
+    if (bits) {
+      const int found = w * WordBits + qCountTrailingZeroBits(bits);
+      return found < size_ ? found : -1;
+    }
+  }
+  return -1;
+}
+
+int BlankLineIndex::findBackward(int block, bool blank)
+{
+  if (!built_)
+    build();
+  if (block >= size_)
+    block = size_ - 1;
+
+  for (int w = block / WordBits; w >= 0 && block >= 0; --w) {
+    quint64 bits = blank ? words_[w] : ~words_[w];
+    if (w == block / WordBits && block % WordBits != WordBits - 1)
+      bits &= (quint64(1) << (block % WordBits + 1)) - 1;
+    if (bits)
+      return w * WordBits + WordBits - 1 - qCountLeadingZeroBits(bits);
+  }
+  return -1;
+}
+
+bool BlankLineIndex::test(int block) const
+{
+  return (words_[block / WordBits] >> (block % WordBits)) & 1;
+}
+
+void BlankLineIndex::assign(int block, bool blank)
+{
+  const quint64 bit = quint64(1) << (block % WordBits);
+  if (blank)
+    words_[block / WordBits] |= bit;
+  else
+    words_[block / WordBits] &= ~bit;
+}
+
+// 64 bits starting at an arbitrary bit of the current words.
+quint64 BlankLineIndex::wordAt(int bit) const
+{
+  const int w = bit / WordBits;
+  const int offset = bit % WordBits;
+  quint64 result = w < int(words_.size()) ? words_[w] >> offset : 0;
+  if (offset && w + 1 < int(words_.size()))
+    result |= words_[w + 1] << (WordBits - offset);
+  return result;
+}
+
+}
+}
@@ -0,0 +1,61 @@
+/**************************************************************************
+**
+** Copyright (c) 2014 Siarhei Rachytski (siarhei.rachytski@gmail.com)
+**
+** GNU Lesser General Public License Usage
+**
+** This file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+
+#pragma once
+
+#include <QtCore/QtGlobal>
+
+#include <vector>
+
+class QTextDocument;
+
+namespace EmacsMode {
+namespace Internal {
+
+struct BlockChange;
+
+// One bit per block of a document, set for blocks that contain only
+// white space. Built on first use and patched for the blocks touched by
+// each edit, so paragraph motions are bit scans instead of walks over
+// the block texts.
+class BlankLineIndex
+{
+public:
+  void setDocument(QTextDocument *document);
+  void clear();
+  void update(const BlockChange &change);
+
+  // Number of the first block at or after block whose blankness equals
+  // blank, -1 if there is none.
+  int findForward(int block, bool blank);
+  // Number of the last block at or before block whose blankness equals
+  // blank, -1 if there is none.
+  int findBackward(int block, bool blank);
+
+private:
+  void build();
+  bool test(int block) const;
+  void assign(int block, bool blank);
+  quint64 wordAt(int bit) const;
+
+  QTextDocument *document_ = nullptr;
+  bool built_ = false;
+  int size_ = 0;
+  std::vector<quint64> words_; // bits past size_ are always clear
+};
+
+}
+}
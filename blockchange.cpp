@@ -0,0 +1,72 @@
+/**************************************************************************
+**
+** Copyright (c) 2014 Siarhei Rachytski (siarhei.rachytski@gmail.com)
+**
+** GNU Lesser General Public License Usage
+**
+** This file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+
+#include "blockchange.hpp"
+
+#include <QtGui/QTextBlock>
+#include <QtGui/QTextDocument>
+
+namespace EmacsMode {
+namespace Internal {
+
+BlockChange::BlockChange()
+  : firstBlock_(-1), removedBlocks_(0), addedBlocks_(0)
+{}
+
+BlockChange::BlockChange(QTextDocument *document, int position, int charsAdded, int oldBlockCount)
+  : BlockChange()
+{
+  QTextBlock first = document->findBlock(position);
+  if (!first.isValid())
+    return;
+
+  QTextBlock last = document->findBlock(position + charsAdded);
+  int lastBlock = last.isValid() ? last.blockNumber() : document->blockCount() - 1;
+
+  firstBlock_ = first.blockNumber();
+  addedBlocks_ = lastBlock - firstBlock_ + 1;
+  removedBlocks_ = addedBlocks_ - (document->blockCount() - oldBlockCount);
+
+  if (removedBlocks_ < 1 || firstBlock_ + removedBlocks_ > oldBlockCount)
+    firstBlock_ = -1;
+}
+
+bool BlockChange::isValid() const
+{
+  return firstBlock_ >= 0;
+}
+
+void BlockChange::merge(const BlockChange &next)
+{
+  if (!isValid() || !next.isValid()) {
+    *this = BlockChange();
+    return;
+  }
+
+  // Union of both ranges in the coordinates between the two changes,
+  // then mapped back before this change and forward after the next one.
+  const int first = qMin(firstBlock_, next.firstBlock_);
+  const int end = qMax(firstBlock_ + addedBlocks_, next.firstBlock_ + next.removedBlocks_);
+  const int removedEnd = end - addedBlocks_ + removedBlocks_;
+  const int addedEnd = end - next.removedBlocks_ + next.addedBlocks_;
+
+  firstBlock_ = first;
+  removedBlocks_ = removedEnd - first;
+  addedBlocks_ = addedEnd - first;
+}
+
+}
+}
@@ -0,0 +1,45 @@
+/**************************************************************************
+**
+** Copyright (c) 2014 Siarhei Rachytski (siarhei.rachytski@gmail.com)
+**
+** GNU Lesser General Public License Usage
+**
+** This file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+
+#pragma once
+
+class QTextDocument;
+
+namespace EmacsMode {
+namespace Internal {
+
+// Blocks touched by a single QTextDocument::contentsChange, expressed
+// as "removedBlocks_ old blocks starting at firstBlock_ were replaced
+// by addedBlocks_ new ones". Lets per-block caches splice themselves
+// instead of rescanning the document.
+struct BlockChange
+{
+  BlockChange();
+  BlockChange(QTextDocument *document, int position, int charsAdded, int oldBlockCount);
+
+  bool isValid() const;
+
+  // Folds a change that happened after this one into a single change
+  // covering both, so updates can be batched and applied later.
+  void merge(const BlockChange &next);
+
+  int firstBlock_;
+  int removedBlocks_;
+  int addedBlocks_;
+};
+
+}
+}
@@ -0,0 +1,349 @@
+/**************************************************************************
+**
+** Copyright (c) 2014 Siarhei Rachytski (siarhei.rachytski@gmail.com)
+**
+** GNU Lesser General Public License Usage
+**
+** This file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+
+#include "bracketindex.hpp"
+#include "blockchange.hpp"
+
+#include <QtCore/QString>
+#include <QtGui/QTextBlock>
+#include <QtGui/QTextDocument>
+
+#include <algorithm>
+#include <iterator>
+
+namespace EmacsMode {
+namespace Internal {
+
+// A quote without a closing quote this close is an apostrophe, not a
+// character literal.
+static const int MaxCharLiteralLength = 8;
+
+// Blocks summarised together, lookups step over this many at a time.
+static const int SpanBlocks = 64;
+
+static bool isOpenBracket(ushort c)
+{
+  return c == '(' || c == '[' || c == '{';
+}
+
+static bool isCloseBracket(ushort c)
+{
+  return c == ')' || c == ']' || c == '}';
+}
+
+static bool isPair(ushort open, ushort close)
+{
+  return (open == '(' && close == ')') || (open == '[' && close == ']')
+      || (open == '{' && close == '}');
+}
+
+void BracketIndex::setDocument(QTextDocument *document)
+{
+  document_ = document;
+  clear();
+}
+
+void BracketIndex::clear()
+{
+  built_ = false;
+  blocks_.clear();
+  spansBuilt_ = false;
+  spans_.clear();
+}
+
+void BracketIndex::ensureBuilt()
+{
+  if (built_ && !spansBuilt_)
+    buildSpans();
+  if (built_ || !document_)
+    return;
+
+  blocks_.resize(document_->blockCount());
+  LexState state = InCode;
+  int i = 0;
+  for (QTextBlock block = document_->begin(); block.isValid(); block = block.next()) {
+    scan(block.text(), state, &blocks_[i]);
+    state = blocks_[i++].exit_;
+  }
+  built_ = true;
+  buildSpans();
+}
+
+// Three integers per block, combined at most once per edit and then
+// shared by every lookup until the next one.
+void BracketIndex::buildSpans()
+{
+  spans_.assign((blocks_.size() + SpanBlocks - 1) / SpanBlocks, Summary());
+  for (int s = 0; s < int(spans_.size()); ++s) {
+    Summary &span = spans_[s];
+    const int end = qMin(int(blocks_.size()), (s + 1) * SpanBlocks);
+    for (int b = s * SpanBlocks; b < end; ++b) {
+      const BlockBrackets &bb = blocks_[b];
+      span.minForward_ = qMin(span.minForward_, span.delta_ + bb.minForward_);
+      span.delta_ += bb.delta_;
+    }
+    int depth = 0;
+    for (int b = end - 1; b >= s * SpanBlocks; --b) {
+      const BlockBrackets &bb = blocks_[b];
+      span.minBackward_ = qMin(span.minBackward_, depth + bb.minBackward_);
+      depth -= bb.delta_;
+    }
+  }
+  spansBuilt_ = true;
+}
+
+void BracketIndex::update(const BlockChange &change)
+{
+  if (!built_)
+    return;
+
+  spansBuilt_ = false;
+  if (!change.isValid() || change.firstBlock_ + change.removedBlocks_ > int(blocks_.size())) {
+    clear();
+    return;
+  }
+
+  const int first = change.firstBlock_;
+  LexState state = first > 0 ? blocks_[first - 1].exit_ : InCode;
+  std::vector<BlockBrackets> added(change.addedBlocks_);
+  QTextBlock block = document_->findBlockByNumber(first);
+  for (int i = 0; i < change.addedBlocks_ && block.isValid(); ++i, block = block.next()) {
+    scan(block.text(), state, &added[i]);
+    state = added[i].exit_;
+  }
+
+  const int common = qMin(change.removedBlocks_, change.addedBlocks_);
+  std::move(added.begin(), added.begin() + common, blocks_.begin() + first);
+  if (change.removedBlocks_ > common)
+    blocks_.erase(blocks_.begin() + first + common, blocks_.begin() + first + change.removedBlocks_);
+  else
+    blocks_.insert(blocks_.begin() + first + common,
+                   std::make_move_iterator(added.begin() + common),
+                   std::make_move_iterator(added.end()));
+
+  if (int(blocks_.size()) != document_->blockCount()) {
+    clear();
+    return;
+  }
+
+  // e.g. an opened "/*" changes the following blocks up to its "*/"
+  for (int b = first + change.addedBlocks_; b < int(blocks_.size()) && blocks_[b].entry_ != state; ++b) {
+    scan(block.text(), state, &blocks_[b]);
+    state = blocks_[b].exit_;
+    block = block.next();
+  }
+}
+
+void BracketIndex::scan(const QString &text, LexState entry, BlockBrackets *result) const
+{
+  result->brackets_.clear();
+  result->entry_ = entry;
+
+  const QChar *chars = text.constData();
+  const int size = text.size();
+  LexState state = entry;
+  int i = 0;
+  while (i < size) {
+    if (state == InBlockComment) {
+      while (i + 1 < size && !(chars[i] == QLatin1Char('*') && chars[i + 1] == QLatin1Char('/')))
+        ++i;
+      if (i + 1 >= size)
+        break;
+      i += 2;
+      state = InCode;
+      continue;
+    }
+
+    const ushort c = chars[i].unicode();
+    if (c == '/' && i + 1 < size && chars[i + 1] == QLatin1Char('/'))
+      break;
+    if (c == '/' && i + 1 < size && chars[i + 1] == QLatin1Char('*')) {
+      state = InBlockComment;
+      i += 2;
+      continue;
+    }
+    if (c == '"' || c == '\'') {
+      const int limit = c == '"' ? size : qMin(size, i + MaxCharLiteralLength);
+      int j = i + 1;
+      while (j < limit && chars[j].unicode() != c)
+        j += chars[j] == QLatin1Char('\\') ? 2 : 1;
+      if (j < limit || c == '"') {
+        i = j + 1;
+        continue;
+      }
+    } else if (isOpenBracket(c) || isCloseBracket(c)) {
+      Bracket bracket;
+      bracket.column_ = i;
+      bracket.char_ = c;
+      result->brackets_.push_back(bracket);
+    }
+    ++i;
+  }
+  result->exit_ = state;
+
+  int depth = 0;
+  result->minForward_ = 0;
+  for (const Bracket &bracket : result->brackets_) {
+    depth += isOpenBracket(bracket.char_) ? 1 : -1;
+    result->minForward_ = qMin(result->minForward_, depth);
+  }
+  result->delta_ = depth;
+
+  depth = 0;
+  result->minBackward_ = 0;
+  for (auto it = result->brackets_.rbegin(); it != result->brackets_.rend(); ++it) {
+    depth += isCloseBracket(it->char_) ? 1 : -1;
+    result->minBackward_ = qMin(result->minBackward_, depth);
+  }
+}
+
+// First bracket at or after fromColumn at which the depth, counting from
+// zero, becomes negative.
+bool BracketIndex::findUnmatchedForward(int block, int fromColumn, int *foundBlock, int *foundIndex) const
+{
+  int depth = 0;
+  for (int b = block; b < int(blocks_.size()); ++b) {
+    if (b != block && b % SpanBlocks == 0) {
+      const Summary &span = spans_[b / SpanBlocks];
+      if (depth + span.minForward_ >= 0) {
+        depth += span.delta_;
+        b += SpanBlocks - 1;
+        continue;
+      }
+    }
+    const BlockBrackets &bb = blocks_[b];
+    if (b != block && depth + bb.minForward_ >= 0) {
+      depth += bb.delta_;
+      continue;
+    }
+    for (int k = 0; k < int(bb.brackets_.size()); ++k) {
+      if (b == block && bb.brackets_[k].column_ < fromColumn)
+        continue;
+      depth += isOpenBracket(bb.brackets_[k].char_) ? 1 : -1;
+      if (depth < 0) {
+        *foundBlock = b;
+        *foundIndex = k;
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+// Last bracket before beforeColumn at which the depth, counting from
+// zero backward, becomes negative.
+bool BracketIndex::findUnmatchedBackward(int block, int beforeColumn, int *foundBlock, int *foundIndex) const
+{
+  int depth = 0;
+  for (int b = block; b >= 0; --b) {
+    // b is below block, so its span is complete
+    if (b != block && b % SpanBlocks == SpanBlocks - 1) {
+      const Summary &span = spans_[b / SpanBlocks];
+      if (depth + span.minBackward_ >= 0) {
+        depth -= span.delta_;
+        b -= SpanBlocks - 1;
+        continue;
+      }
+    }
+    const BlockBrackets &bb = blocks_[b];
+    if (b != block && depth + bb.minBackward_ >= 0) {
+      depth -= bb.delta_;
+      continue;
+    }
+    for (int k = int(bb.brackets_.size()) - 1; k >= 0; --k) {
+      if (b == block && bb.brackets_[k].column_ >= beforeColumn)
+        continue;
+      depth += isCloseBracket(bb.brackets_[k].char_) ? 1 : -1;
+      if (depth < 0) {
+        *foundBlock = b;
+        *foundIndex = k;
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+int BracketIndex::indexAt(int block, int column) const
+{
+  const std::vector<Bracket> &brackets = blocks_[block].brackets_;
+  const auto it = std::lower_bound(brackets.begin(), brackets.end(), column,
+                                   [](const Bracket &b, int c) { return b.column_ < c; });
+  return it != brackets.end() && it->column_ == column ? int(it - brackets.begin()) : -1;
+}
+
+int BracketIndex::positionOf(int block, int index) const
+{
+  return document_->findBlockByNumber(block).position() + blocks_[block].brackets_[index].column_;
+}
+
+bool BracketIndex::isBracketAt(int pos)
+{
+  ensureBuilt();
+  const QTextBlock block = document_->findBlock(pos);
+  return built_ && block.isValid() && indexAt(block.blockNumber(), pos - block.position()) != -1;
+}
+
+bool BracketIndex::isBracketAt(int block, int column)
+{
+  ensureBuilt();
+  return built_ && block >= 0 && block < int(blocks_.size()) && indexAt(block, column) != -1;
+}
+
+int BracketIndex::matchingBracket(int pos)
+{
+  ensureBuilt();
+  const QTextBlock block = document_->findBlock(pos);
+  if (!built_ || !block.isValid())
+    return -1;
+
+  const int b = block.blockNumber();
+  const int column = pos - block.position();
+  const int index = indexAt(b, column);
+  if (index == -1)
+    return -1;
+
+  const ushort c = blocks_[b].brackets_[index].char_;
+  int foundBlock = 0;
+  int foundIndex = 0;
+  const bool found = isOpenBracket(c)
+      ? findUnmatchedForward(b, column + 1, &foundBlock, &foundIndex)
+      : findUnmatchedBackward(b, column, &foundBlock, &foundIndex);
+  if (!found)
+    return -1;
+
+  const ushort other = blocks_[foundBlock].brackets_[foundIndex].char_;
+  if (isOpenBracket(c) ? !isPair(c, other) : !isPair(other, c))
+    return -1;
+  return positionOf(foundBlock, foundIndex);
+}
+
+int BracketIndex::enclosingOpenBracket(int pos)
+{
+  ensureBuilt();
+  const QTextBlock block = document_->findBlock(pos);
+  if (!built_ || !block.isValid())
+    return -1;
+
+  int foundBlock = 0;
+  int foundIndex = 0;
+  if (!findUnmatchedBackward(block.blockNumber(), pos - block.position(), &foundBlock, &foundIndex))
+    return -1;
+  return positionOf(foundBlock, foundIndex);
+}
+
+}
+}
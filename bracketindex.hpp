@@ -0,0 +1,100 @@
+/**************************************************************************
+**
+** Copyright (c) 2014 Siarhei Rachytski (siarhei.rachytski@gmail.com)
+**
+** GNU Lesser General Public License Usage
+**
+** This file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+
+#pragma once
+
+#include <QtCore/QtGlobal>
+
+#include <vector>
+
+class QString;
+class QTextDocument;
+
+namespace EmacsMode {
+namespace Internal {
+
+struct BlockChange;
+
+// Brackets outside of strings and comments, kept per block together with
+// a depth summary of the block, so matching a bracket skips every block
+// that cannot contain the match without looking at its brackets. The
+// block summaries are combined into one per SpanBlocks blocks as well,
+// so a match far away skips whole spans.
+//
+// After an edit only the touched blocks are rescanned, plus the blocks
+// following them until the lexer state at a block start (e.g. "inside a
+// block comment") is the same as before.
+class BracketIndex
+{
+public:
+  void setDocument(QTextDocument *document);
+  void clear();
+  void update(const BlockChange &change);
+
+  // Whether pos holds a bracket that is not in a string or comment.
+  bool isBracketAt(int pos);
+  // The same for a column of a block, without looking the block up.
+  bool isBracketAt(int block, int column);
+  // Position of the bracket matching the one at pos, -1 if unbalanced.
+  int matchingBracket(int pos);
+  // Innermost open bracket before pos that is not closed before pos,
+  // -1 at top level.
+  int enclosingOpenBracket(int pos);
+
+private:
+  enum LexState : quint8
+  {
+    InCode,
+    InBlockComment
+  };
+
+  struct Bracket
+  {
+    int column_;
+    ushort char_;
+  };
+
+  struct Summary
+  {
+    int delta_ = 0;       // opening minus closing brackets
+    int minForward_ = 0;  // lowest depth reached scanning forward from 0
+    int minBackward_ = 0; // the same scanning backward
+  };
+
+  struct BlockBrackets : Summary
+  {
+    std::vector<Bracket> brackets_;
+    LexState entry_ = InCode;
+    LexState exit_ = InCode;
+  };
+
+  void ensureBuilt();
+  void buildSpans();
+  void scan(const QString &text, LexState entry, BlockBrackets *result) const;
+  bool findUnmatchedForward(int block, int fromColumn, int *foundBlock, int *foundIndex) const;
+  bool findUnmatchedBackward(int block, int beforeColumn, int *foundBlock, int *foundIndex) const;
+  int indexAt(int block, int column) const;
+  int positionOf(int block, int index) const;
+
+  QTextDocument *document_ = nullptr;
+  bool built_ = false;
+  std::vector<BlockBrackets> blocks_;
+  bool spansBuilt_ = false; // rebuilt on the first lookup after an edit
+  std::vector<Summary> spans_; // blocks [i * SpanBlocks, (i + 1) * SpanBlocks)
+};
+
+}
+}
@@ -0,0 +1,199 @@
+/**************************************************************************
+**
+** Copyright (c) 2014 Siarhei Rachytski (siarhei.rachytski@gmail.com)
+**
+** GNU Lesser General Public License Usage
+**
+** This file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+
+#include "documentwriter.hpp"
+
+#include <QtConcurrent/QtConcurrentRun>
+#include <QtCore/QByteArray>
+#include <QtCore/QCoreApplication>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QFutureWatcher>
+#include <QtCore/QSaveFile>
+#include <QtGui/QTextDocument>
+
+namespace EmacsMode {
+namespace Internal {
+
+// Characters encoded for each write.
+static const int WriteChunkSize = 256 * 1024;
+
+// Files written at the same time. Writes mostly wait on the disk or the
+// network, so this is not tied to the number of cores.
+static const int MaxConcurrentWrites = 8;
+
+static DocumentSaver *theSaver = nullptr;
+
+QString documentText(const QTextDocument *document)
+{
+  return document->toRawText();
+}
+
+bool writeText(const QString &text, const QString &fileName, WriteResult *result)
+{
+  result->fileName_ = fileName;
+  result->lines_ = 0;
+  result->bytes_ = 0;
+  result->created_ = !QFileInfo::exists(fileName);
+
+  QSaveFile file(fileName);
+  if (!file.open(QIODevice::WriteOnly)) {
+    result->error_ = QCoreApplication::translate("EmacsMode::Internal", "Cannot open file '%1' for writing: %2")
+        .arg(fileName, file.errorString());
+    return false;
+  }
+
+  // reserved, so clearing it with resize(0) keeps the allocation
+  QString piece;
+  piece.reserve(WriteChunkSize);
+  for (int i = 0; i < text.size(); ) {
+    int size = qMin(WriteChunkSize, text.size() - i);
+    // a surrogate pair is encoded as a whole
+    if (i + size < text.size() && text.at(i + size - 1).isHighSurrogate())
+      --size;
+    piece.resize(0);
+    piece.append(text.constData() + i, size);
+    piece.replace(QChar::ParagraphSeparator, QLatin1Char('\n'));
+    i += size;
+
+    const QByteArray chunk = piece.toLocal8Bit();
+    if (file.write(chunk) != chunk.size()) {
+      file.cancelWriting();
+      result->error_ = QCoreApplication::translate("EmacsMode::Internal", "Cannot write file '%1': %2")
+          .arg(fileName, file.errorString());
+      return false;
+    }
+    result->lines_ += chunk.count('\n');
+    result->bytes_ += chunk.size();
+  }
+
+  if (!file.commit()) {
+    result->error_ = QCoreApplication::translate("EmacsMode::Internal", "Cannot write file '%1': %2")
+        .arg(fileName, file.errorString());
+    return false;
+  }
+  return true;
+}
+
+// Replaces fileName~ by a copy of fileName.
+static void makeBackup(const QString &fileName, WriteResult *result)
+{
+  const QString backupName = fileName + QLatin1Char('~');
+  if (QFile::exists(backupName) && !QFile::remove(backupName)) {
+    result->backupError_ = QCoreApplication::translate("EmacsMode::Internal", "Cannot remove old backup file '%1'")
+        .arg(backupName);
+    return;
+  }
+  QFile file(fileName);
+  if (!file.copy(backupName)) {
+    result->backupError_ = QCoreApplication::translate("EmacsMode::Internal", "Cannot make backup file '%1': %2")
+        .arg(backupName, file.errorString());
+    return;
+  }
+  result->backedUp_ = true;
+}
+
+DocumentSaver::DocumentSaver(QObject *parent)
+  : QObject(parent)
+{
+  pool_.setMaxThreadCount(MaxConcurrentWrites);
+  theSaver = this;
+}
+
+DocumentSaver::~DocumentSaver()
+{
+  pool_.waitForDone();
+  theSaver = nullptr;
+}
+
+DocumentSaver *DocumentSaver::instance()
+{
+  return theSaver;
+}
+
+void DocumentSaver::save(const QString &fileName, const QString &text, bool backup,
+                         const Callback &done)
+{
+  Job job;
+  job.fileName_ = fileName;
+  job.text_ = text;
+  job.backup_ = backup;
+  job.done_.append(done);
+
+  for (const Job &running : running_) {
+    if (running.fileName_ != fileName)
+      continue;
+    // the older snapshot is never written, its callers hear about this one
+    auto it = waiting_.find(fileName);
+    if (it != waiting_.end()) {
+      job.backup_ = job.backup_ || it->backup_;
+      job.done_ = it->done_ + job.done_;
+    }
+    waiting_.insert(fileName, job);
+    return;
+  }
+  start(job);
+}
+
+bool DocumentSaver::isIdle() const
+{
+  return running_.isEmpty();
+}
+
+void DocumentSaver::start(const Job &job)
+{
+  auto *watcher = new QFutureWatcher<WriteResult>(this);
+  running_.insert(watcher, job);
+  connect(watcher, SIGNAL(finished()), SLOT(onWriteFinished()));
+
+  const QString fileName = job.fileName_;
+  const QString text = job.text_;
+  const bool backup = job.backup_;
+  watcher->setFuture(QtConcurrent::run(&pool_, [fileName, text, backup]() {
+    WriteResult result;
+    if (backup && QFileInfo::exists(fileName))
+      makeBackup(fileName, &result);
+    writeText(text, fileName, &result);
+    return result;
+  }));
+}
+
+void DocumentSaver::onWriteFinished()
+{
+  auto *watcher = static_cast<QFutureWatcher<WriteResult> *>(sender());
+  const Job job = running_.take(watcher);
+  const WriteResult result = watcher->result();
+  watcher->deleteLater();
+
+  // the next save of the file may start before the callbacks run
+  auto it = waiting_.find(job.fileName_);
+  if (it != waiting_.end()) {
+    Job next = it.value();
+    waiting_.erase(it);
+    // asked for before this backup was made, which holds the older text
+    if (result.backedUp_)
+      next.backup_ = false;
+    start(next);
+  }
+
+  for (const Callback &done : job.done_)
+    done(result);
+  if (running_.isEmpty())
+    emit idle();
+}
+
+}
+}
@@ -0,0 +1,104 @@
+/**************************************************************************
+**
+** Copyright (c) 2014 Siarhei Rachytski (siarhei.rachytski@gmail.com)
+**
+** GNU Lesser General Public License Usage
+**
+** This file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+
+#pragma once
+
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QObject>
+#include <QtCore/QString>
+#include <QtCore/QThreadPool>
+
+#include <functional>
+
+class QTextDocument;
+
+template <typename T> class QFutureWatcher;
+
+namespace EmacsMode {
+namespace Internal {
+
+struct WriteResult
+{
+  QString fileName_;
+  qint64 lines_ = 0;
+  qint64 bytes_ = 0;
+  bool created_ = false; // the file did not exist before
+  QString error_;        // empty on success
+  bool backedUp_ = false;
+  QString backupError_;  // empty unless making fileName~ failed
+};
+
+// The text of the document in one string, blocks are separated by
+// QChar::ParagraphSeparator. QString is implicitly shared, so the
+// snapshot is a single copy that can be read on any thread while
+// editing goes on.
+QString documentText(const QTextDocument *document);
+
+// Writes the text to fileName with '\n' between the blocks. It is
+// encoded a chunk at a time into a temporary file that replaces fileName
+// only once everything is written, so a failed save leaves the old file
+// as it was. Lines and bytes are counted on the way.
+bool writeText(const QString &text, const QString &fileName, WriteResult *result);
+
+// Runs writeText on worker threads. Saves of the same file run one after
+// the other, saves of different files run side by side up to the pool's
+// limit. Owned by the plugin, which waits for the writes on shutdown.
+class DocumentSaver : public QObject
+{
+  Q_OBJECT
+
+public:
+  typedef std::function<void(const WriteResult &)> Callback;
+
+  explicit DocumentSaver(QObject *parent = nullptr);
+  ~DocumentSaver();
+
+  static DocumentSaver *instance();
+
+  // done is called on this thread when the write has finished. With
+  // backup the old file, if there is one, is first copied to fileName~.
+  // A failed copy is reported in the result and does not stop the save.
+  void save(const QString &fileName, const QString &text, bool backup,
+            const Callback &done);
+
+  bool isIdle() const;
+
+signals:
+  void idle(); // the last write has finished
+
+private slots:
+  void onWriteFinished();
+
+private:
+  struct Job
+  {
+    QString fileName_;
+    QString text_;
+    bool backup_;
+    QList<Callback> done_; // of the saves it stands for
+  };
+
+  void start(const Job &job);
+
+  QThreadPool pool_;
+  QHash<QFutureWatcher<WriteResult> *, Job> running_;
+  // behind a running save of the file, a newer save replaces it
+  QHash<QString, Job> waiting_;
+};
+
+}
+}
@@ -1,7 +1,7 @@
 # CONFIG += single
 include(../../qtcreatorplugin.pri)
 
-QT += gui
+QT += gui concurrent
 SOURCES += emacsmodehandler.cpp \
     emacsmodeplugin.cpp \
     emacsmodesettings.cpp \
@@ -10,6 +10,21 @@ SOURCES += emacsmodehandler.cpp \
     minibuffer.cpp \
     pluginstate.cpp \
     range.cpp \
+    blockchange.cpp \
+    wordindex.cpp \
+    symboldictionary.cpp \
+    textscan.cpp \
+    blanklineindex.cpp \
+    bracketindex.cpp \
+    lineindex.cpp \
+    rectangle.cpp \
+    fill.cpp \
+    whitespace.cpp \
+    sortlines.cpp \
+    shellcommand.cpp \
+    documentwriter.cpp \
+    autosave.cpp \
+    filecompletion.cpp \
 
 HEADERS += emacsmodehandler.h \
     emacsmodeplugin.h \
@@ -19,6 +34,25 @@ HEADERS += emacsmodehandler.h \
     minibuffer.hpp \
     pluginstate.hpp \
     range.hpp \
+    blockchange.hpp \
+    wordindex.hpp \
+    symboldictionary.hpp \
+    textscan.hpp \
+    blanklineindex.hpp \
+    bracketindex.hpp \
+    lineindex.hpp \
+    rectangle.hpp \
+    fill.hpp \
+    whitespace.hpp \
+    sortlines.hpp \
+    shellcommand.hpp \
+    documentwriter.hpp \
+    autosave.hpp \
+    filecompletion.hpp \
+
+equals(TEST, 1) {
+    SOURCES += emacsmode_test.cpp
+}
 
 FORMS += emacsmodeoptions.ui
 
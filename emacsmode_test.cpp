@@ -0,0 +1,788 @@
+/**************************************************************************
+**
+** Copyright (c) 2014 Siarhei Rachytski (siarhei.rachytski@gmail.com)
+**
+** GNU Lesser General Public License Usage
+**
+** This file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+
+#include "emacsmodeplugin.hpp"
+#include "autosave.hpp"
+#include "blockchange.hpp"
+#include "bracketindex.hpp"
+#include "emacsmodehandler.hpp"
+#include "emacsmodesettings.hpp"
+#include "fill.hpp"
+#include "sortlines.hpp"
+#include "symboldictionary.hpp"
+#include "textscan.hpp"
+#include "wordindex.hpp"
+
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QRandomGenerator>
+#include <QtCore/QTemporaryDir>
+#include <QtWidgets/QPlainTextEdit>
+#include <QtGui/QTextBlock>
+#include <QtGui/QTextCursor>
+#include <QtGui/QTextDocument>
+#include <QtTest/QtTest>
+
+#include <algorithm>
+#include <numeric>
+
+namespace EmacsMode {
+namespace Internal {
+
+// The loops the kernels replaced, one character at a time.
+
+static int referenceSkipForward(const QString &text, int from, CharClass charClass)
+{
+  int i = from;
+  while (i < text.size() && isInClass(text.at(i), charClass))
+    ++i;
+  return i;
+}
+
+static int referenceSkipBackward(const QString &text, int from, CharClass charClass)
+{
+  int i = from;
+  while (i > 0 && isInClass(text.at(i - 1), charClass))
+    --i;
+  return i;
+}
+
+static int referenceColumnAt(const QString &text, int index, int tabSize)
+{
+  int column = 0;
+  for (int i = 0; i < qMin(index, text.size()); ++i)
+    column = text.at(i) == QLatin1Char('\t') ? (column / tabSize + 1) * tabSize : column + 1;
+  return column;
+}
+
+static int referenceIndexAtColumn(const QString &text, int column, int tabSize)
+{
+  int i = 0;
+  int current = 0;
+  for (; i < text.size() && current < column; ++i)
+    current = text.at(i) == QLatin1Char('\t') ? (current / tabSize + 1) * tabSize : current + 1;
+  return i;
+}
+
+// Mixes ASCII blanks and word characters with characters the SSE2 paths
+// must hand to the QChar tables: Latin-1 letters and spaces, Cyrillic,
+// the ideographic space and a CJK ideograph.
+static QString randomText(int length, quint32 seed)
+{
+  static const ushort alphabet[] = {' ', '\t', '\r', 'a', 'Z', '_', '0', '-',
+                                    0xe9, 0xa0, 0x430, 0x3000, 0x4e2d};
+  QRandomGenerator generator(seed);
+  QString text;
+  for (int i = 0; i < length; ++i)
+    text += QChar(alphabet[generator.bounded(int(sizeof(alphabet) / sizeof(alphabet[0])))]);
+  return text;
+}
+
+void EmacsModePlugin::test_textScan_data()
+{
+  QTest::addColumn<QString>("text");
+
+  // lengths around the eight characters of a class chunk and the
+  // sixteen of a find step
+  for (int length : {0, 1, 7, 8, 9, 15, 16, 17, 31, 32, 33, 64})
+    for (quint32 seed = 1; seed <= 4; ++seed)
+      QTest::newRow(qPrintable(QString::fromLatin1("random %1/%2").arg(length).arg(seed)))
+          << randomText(length, seed);
+
+  QTest::newRow("blank 16") << QString(16, QLatin1Char(' '));
+  QTest::newRow("blank 16 word") << QString(16, QLatin1Char(' ')) + QLatin1String("word");
+  QTest::newRow("tabs 9") << QString(9, QLatin1Char('\t')) + QLatin1Char('x');
+  QTest::newRow("word 17") << QString(17, QLatin1Char('w'));
+  QTest::newRow("latin1 at 7") << QString(7, QLatin1Char(' ')) + QChar(0xe9) + QString(8, QLatin1Char(' '));
+  QTest::newRow("latin1 space at 8") << QString(8, QLatin1Char(' ')) + QChar(0xa0) + QLatin1String("  x  ");
+  QTest::newRow("ideographic space at 15") << QString(15, QLatin1Char('\t')) + QChar(0x3000) + QLatin1Char('y');
+  QTest::newRow("cyrillic 16") << QString(16, QChar(0x430));
+  QTest::newRow("trailing blanks") << QLatin1String("int x;") + QString(17, QLatin1Char(' '));
+  QTest::newRow("trailing mixed blanks") << QString::fromLatin1("x \t\r") + QChar(0x3000) + QString(8, QLatin1Char(' '));
+}
+
+void EmacsModePlugin::test_textScan()
+{
+  QFETCH(QString, text);
+
+  const QChar *chars = text.constData();
+  for (CharClass charClass : {WordChars, NonWordChars, BlankChars, NonBlankChars}) {
+    for (int from = 0; from <= text.size(); ++from) {
+      QCOMPARE(skipForward(chars, text.size(), from, charClass),
+               referenceSkipForward(text, from, charClass));
+      QCOMPARE(skipBackward(chars, from, charClass),
+               referenceSkipBackward(text, from, charClass));
+    }
+  }
+
+  const int first = referenceSkipForward(text, 0, BlankChars);
+  const int trailing = referenceSkipBackward(text, text.size(), BlankChars);
+  QCOMPARE(firstNonBlank(text), first);
+  QCOMPARE(trailingWhitespaceStart(text), trailing);
+  QCOMPARE(lastNonBlank(text), trailing - 1);
+  QCOMPARE(isBlank(text), first == text.size());
+
+  for (QChar c : {QChar(QLatin1Char(' ')), QChar(QLatin1Char('\t')), QChar(0x430), QChar(0x4e2d)}) {
+    for (int from = 0; from <= text.size(); ++from) {
+      QCOMPARE(findForward(chars, text.size(), from, c), text.indexOf(c, from));
+      QCOMPARE(findBackward(chars, from, c), from == 0 ? -1 : text.lastIndexOf(c, from - 1));
+    }
+  }
+}
+
+void EmacsModePlugin::test_textScanColumns_data()
+{
+  QTest::addColumn<QString>("text");
+  QTest::addColumn<int>("tabSize");
+
+  for (int tabSize : {1, 4, 8}) {
+    const auto row = [tabSize](const char *name) {
+      return QString::fromLatin1("%1 %2").arg(QLatin1String(name)).arg(tabSize).toLatin1();
+    };
+    QTest::newRow(row("no tabs").constData()) << QString::fromLatin1("    int x = 0;") << tabSize;
+    QTest::newRow(row("leading tabs").constData()) << QString::fromLatin1("\t\tif (x)") << tabSize;
+    QTest::newRow(row("tab after 7").constData()) << QString::fromLatin1("1234567\tx") << tabSize;
+    QTest::newRow(row("tab after 8").constData()) << QString::fromLatin1("12345678\tx") << tabSize;
+    QTest::newRow(row("tab after 17").constData()) << QString(17, QLatin1Char('x')) + QLatin1String("\t\ty") << tabSize;
+    QTest::newRow(row("mixed indentation").constData()) << QString::fromLatin1(" \t  \t x") << tabSize;
+    QTest::newRow(row("non latin1").constData()) << QString(3, QChar(0x430)) + QLatin1Char('\t') + QChar(0x3000) + QLatin1String("\tz") << tabSize;
+    QTest::newRow(row("random").constData()) << randomText(40, quint32(tabSize)) << tabSize;
+  }
+}
+
+void EmacsModePlugin::test_textScanColumns()
+{
+  QFETCH(QString, text);
+  QFETCH(int, tabSize);
+
+  for (int index = 0; index <= text.size() + 1; ++index)
+    QCOMPARE(columnAt(text, index, tabSize), referenceColumnAt(text, index, tabSize));
+
+  const int width = referenceColumnAt(text, text.size(), tabSize);
+  for (int column = 0; column <= width + 2; ++column)
+    QCOMPARE(indexAtColumn(text, column, tabSize), referenceIndexAtColumn(text, column, tabSize));
+
+  QCOMPARE(indentationWidth(text, tabSize),
+           referenceColumnAt(text, referenceSkipForward(text, 0, BlankChars), tabSize));
+}
+
+// Lines indented like source code, a few with trailing white space.
+static QTextDocument *indentedDocument(QObject *parent)
+{
+  QString text;
+  for (int i = 0; i < 2000; ++i) {
+    text += QString(4 * (i % 6), QLatin1Char(' '));
+    text += QLatin1String("value = compute(value, ") + QString::number(i) + QLatin1String(");");
+    if (i % 5 == 0)
+      text += QLatin1String("  \t");
+    text += QLatin1Char('\n');
+  }
+  return new QTextDocument(text, parent);
+}
+
+void EmacsModePlugin::test_benchFirstNonBlank_data()
+{
+  QTest::addColumn<bool>("characterAt");
+
+  QTest::newRow("characterAt") << true;
+  QTest::newRow("textscan") << false;
+}
+
+void EmacsModePlugin::test_benchFirstNonBlank()
+{
+  QFETCH(bool, characterAt);
+
+  QObject parent;
+  QTextDocument *doc = indentedDocument(&parent);
+  int total = 0;
+  if (characterAt) {
+    // as moveToNonBlankOnLine did
+    QBENCHMARK {
+      for (QTextBlock block = doc->begin(); block.isValid(); block = block.next()) {
+        int i = block.position();
+        const int maxPos = block.position() + block.length() - 1;
+        while (doc->characterAt(i).isSpace() && i < maxPos)
+          ++i;
+        total += i - block.position();
+      }
+    }
+  } else {
+    QBENCHMARK {
+      for (QTextBlock block = doc->begin(); block.isValid(); block = block.next())
+        total += firstNonBlank(block.text());
+    }
+  }
+  QVERIFY(total > 0);
+}
+
+void EmacsModePlugin::test_benchTrailingWhitespace_data()
+{
+  QTest::addColumn<bool>("characterAt");
+
+  QTest::newRow("characterAt") << true;
+  QTest::newRow("textscan") << false;
+}
+
+void EmacsModePlugin::test_benchTrailingWhitespace()
+{
+  QFETCH(bool, characterAt);
+
+  QObject parent;
+  QTextDocument *doc = indentedDocument(&parent);
+  int total = 0;
+  if (characterAt) {
+    QBENCHMARK {
+      for (QTextBlock block = doc->begin(); block.isValid(); block = block.next()) {
+        int i = block.position() + block.length() - 1;
+        while (i > block.position() && doc->characterAt(i - 1).isSpace())
+          --i;
+        total += i - block.position();
+      }
+    }
+  } else {
+    QBENCHMARK {
+      for (QTextBlock block = doc->begin(); block.isValid(); block = block.next())
+        total += trailingWhitespaceStart(block.text());
+    }
+  }
+  QVERIFY(total > 0);
+}
+
+// The modifier <META> stands for in shortcuts.
+#if defined(Q_OS_WIN) || defined(Q_OS_LINUX)
+static const Qt::KeyboardModifier MetaModifier = Qt::ControlModifier;
+#else
+static const Qt::KeyboardModifier MetaModifier = Qt::MetaModifier;
+#endif
+
+// C-e C-m M-}: inserts a blank line, then moves by the blank line index.
+static void typeNewLineAndForwardParagraph(QWidget *editor)
+{
+  QTest::keyClick(editor, Qt::Key_E, MetaModifier);
+  QTest::keyClick(editor, Qt::Key_M, MetaModifier);
+  QTest::keyClick(editor, Qt::Key_BraceRight, Qt::AltModifier | Qt::ShiftModifier);
+}
+
+void EmacsModePlugin::test_macroReplayUpdatesIndexes()
+{
+  Utils::SavedAction *useEmacsMode = theEmacsModeSetting(ConfigUseEmacsMode);
+  const QVariant wasUsingEmacsMode = useEmacsMode->value();
+  useEmacsMode->setValue(true);
+
+  const QString text = QString::fromLatin1("a\nb\n\nc\nd\n\ne\nf\n\ng\nh\n\ni");
+
+  // typed three times
+  QPlainTextEdit typed(text);
+  EmacsModeHandler typedHandler(&typed);
+  typedHandler.installEventFilter();
+  for (int i = 0; i < 3; ++i)
+    typeNewLineAndForwardParagraph(&typed);
+
+  // typed once while recording, then replayed twice as one command
+  QPlainTextEdit replayed(text);
+  EmacsModeHandler replayedHandler(&replayed);
+  replayedHandler.installEventFilter();
+  QTest::keyClick(&replayed, Qt::Key_X, MetaModifier);
+  QTest::keyClick(&replayed, Qt::Key_ParenLeft, Qt::ShiftModifier);
+  typeNewLineAndForwardParagraph(&replayed);
+  QTest::keyClick(&replayed, Qt::Key_X, MetaModifier);
+  QTest::keyClick(&replayed, Qt::Key_ParenRight, Qt::ShiftModifier);
+  QTest::keyClick(&replayed, Qt::Key_2, Qt::AltModifier);
+  QTest::keyClick(&replayed, Qt::Key_X, MetaModifier);
+  QTest::keyClick(&replayed, Qt::Key_E);
+
+  useEmacsMode->setValue(wasUsingEmacsMode);
+
+  QCOMPARE(replayed.toPlainText(), typed.toPlainText());
+  QCOMPARE(replayed.textCursor().position(), typed.textCursor().position());
+
+  // the replay is undone as one step
+  replayed.undo();
+  QCOMPARE(replayed.toPlainText(), QString::fromLatin1("a\n\nb\n\nc\nd\n\ne\nf\n\ng\nh\n\ni"));
+}
+
+// C-e C-m M-{ x: inserts a blank line, then writes into the blank line the
+// blank line index finds before it.
+static void typeNewLineAndMarkPreviousBlankLine(QWidget *editor)
+{
+  QTest::keyClick(editor, Qt::Key_E, MetaModifier);
+  QTest::keyClick(editor, Qt::Key_M, MetaModifier);
+  QTest::keyClick(editor, Qt::Key_BraceLeft, Qt::AltModifier | Qt::ShiftModifier);
+  QTest::keyClick(editor, Qt::Key_X);
+}
+
+void EmacsModePlugin::test_macroReplayOnRegionLinesUpdatesIndexes()
+{
+  Utils::SavedAction *useEmacsMode = theEmacsModeSetting(ConfigUseEmacsMode);
+  const QVariant wasUsingEmacsMode = useEmacsMode->value();
+  useEmacsMode->setValue(true);
+
+  const int lineCount = 500;
+  QStringList lines;
+  for (int i = 0; i < lineCount; ++i)
+    lines.append(QString::fromLatin1("line %1").arg(i));
+  const QString text = lines.join(QLatin1Char('\n'));
+
+  // typed at the start of every line, cursors keep the line starts
+  // while the edits move them
+  QPlainTextEdit typed(text);
+  EmacsModeHandler typedHandler(&typed);
+  typedHandler.installEventFilter();
+  QList<QTextCursor> lineStarts;
+  for (QTextBlock block = typed.document()->begin(); block.isValid(); block = block.next())
+    lineStarts.append(QTextCursor(block));
+  for (const QTextCursor &lineStart : lineStarts) {
+    typed.setTextCursor(lineStart);
+    typeNewLineAndMarkPreviousBlankLine(&typed);
+  }
+
+  // recorded on the first line, undone, then applied to every line
+  QPlainTextEdit replayed(text);
+  EmacsModeHandler replayedHandler(&replayed);
+  replayedHandler.installEventFilter();
+  QTest::keyClick(&replayed, Qt::Key_X, MetaModifier);
+  QTest::keyClick(&replayed, Qt::Key_ParenLeft, Qt::ShiftModifier);
+  typeNewLineAndMarkPreviousBlankLine(&replayed);
+  QTest::keyClick(&replayed, Qt::Key_X, MetaModifier);
+  QTest::keyClick(&replayed, Qt::Key_ParenRight, Qt::ShiftModifier);
+  while (replayed.document()->isUndoAvailable())
+    replayed.undo();
+  QCOMPARE(replayed.toPlainText(), text);
+
+  QTextCursor region(replayed.document());
+  region.movePosition(QTextCursor::End, QTextCursor::KeepAnchor);
+  replayed.setTextCursor(region);
+  QTest::keyClick(&replayed, Qt::Key_X, MetaModifier);
+  QTest::keyClick(&replayed, Qt::Key_K, MetaModifier);
+  QTest::keyClick(&replayed, Qt::Key_R);
+
+  useEmacsMode->setValue(wasUsingEmacsMode);
+
+  QCOMPARE(replayed.toPlainText(), typed.toPlainText());
+  QCOMPARE(replayed.toPlainText().count(QLatin1Char('x')), lineCount);
+
+  // all lines are undone as one step
+  replayed.undo();
+  QCOMPARE(replayed.toPlainText(), text);
+}
+
+static QString replayJournal(const QString &journalName)
+{
+  QString text;
+  QString error;
+  if (!AutoSaveJournal::replay(journalName, &text, &error))
+    return QLatin1String("error: ") + error;
+  return text;
+}
+
+void EmacsModePlugin::test_autoSaveJournal()
+{
+  Utils::SavedAction *autoSave = theEmacsModeSetting(ConfigAutoSave);
+  const QVariant wasAutoSaving = autoSave->value();
+  autoSave->setValue(true);
+
+  QTemporaryDir dir;
+  QVERIFY(dir.isValid());
+  const QString fileName = dir.filePath(QLatin1String("journaled.txt"));
+  const QString journalName = AutoSaveJournal::journalName(fileName);
+
+  QTextDocument doc(QLatin1String("alpha\nbeta\ngamma"));
+  AutoSaveJournal *journal = AutoSaveJournal::forDocument(&doc);
+  journal->setFileName(fileName);
+  QTextCursor cursor(&doc);
+
+  // edits before the first flush are part of the snapshot
+  cursor.insertText(QLatin1String(">"));
+  journal->flushAndWait();
+  QCOMPARE(replayJournal(journalName), doc.toPlainText());
+
+  // at the document end, where Qt's last paragraph separator is
+  cursor.movePosition(QTextCursor::End);
+  cursor.insertText(QLatin1String("\ndelta"));
+  cursor.movePosition(QTextCursor::End);
+  cursor.deletePreviousChar();
+  cursor.select(QTextCursor::BlockUnderCursor);
+  cursor.removeSelectedText();
+  journal->flushAndWait();
+  QCOMPARE(replayJournal(journalName), doc.toPlainText());
+
+  // several edits reported as one change
+  cursor.beginEditBlock();
+  cursor.setPosition(3);
+  cursor.insertText(QLatin1String("12"));
+  cursor.insertBlock();
+  cursor.setPosition(9);
+  cursor.setPosition(12, QTextCursor::KeepAnchor);
+  cursor.removeSelectedText();
+  cursor.movePosition(QTextCursor::End);
+  cursor.insertText(QLatin1String(" end"));
+  cursor.endEditBlock();
+  journal->flushAndWait();
+  QCOMPARE(replayJournal(journalName), doc.toPlainText());
+
+  // the whole text replaced
+  doc.setPlainText(QLatin1String("first\n\nthird\n"));
+  doc.setModified(true);
+  journal->flushAndWait();
+  QCOMPARE(replayJournal(journalName), doc.toPlainText());
+
+  // a record cut short by a crash ends the journal
+  const QString beforeLastEdit = doc.toPlainText();
+  const qint64 sizeBeforeLastEdit = QFileInfo(journalName).size();
+  cursor = QTextCursor(&doc);
+  cursor.setPosition(2);
+  cursor.insertText(QLatin1String("last edit"));
+  journal->flushAndWait();
+  QCOMPARE(replayJournal(journalName), doc.toPlainText());
+  QFile file(journalName);
+  QVERIFY(file.open(QIODevice::ReadWrite));
+  QVERIFY(file.size() > sizeBeforeLastEdit + 3);
+  QVERIFY(file.resize(file.size() - 3));
+  file.close();
+  QCOMPARE(replayJournal(journalName), beforeLastEdit);
+
+  autoSave->setValue(wasAutoSaving);
+}
+
+void EmacsModePlugin::test_fillParagraph_data()
+{
+  QTest::addColumn<QStringList>("lines");
+  QTest::addColumn<int>("fillColumn");
+  QTest::addColumn<int>("mode");
+  QTest::addColumn<bool>("changed");
+  QTest::addColumn<int>("first");
+  QTest::addColumn<int>("count");
+  QTest::addColumn<QStringList>("filled");
+
+  const auto lines = [](const char *text) {
+    return QString::fromLatin1(text).split(QLatin1Char('|'));
+  };
+
+  QTest::newRow("already filled")
+      << lines("aaa bbb|ccc ddd") << 7 << int(GreedyFill)
+      << false << 0 << 0 << lines("aaa bbb|ccc ddd");
+  QTest::newRow("already filled optimal")
+      << lines("aaa|bb cc|ddddd") << 6 << int(OptimalFill)
+      << false << 0 << 0 << lines("aaa|bb cc|ddddd");
+  QTest::newRow("prefix only")
+      << lines("// ") << 10 << int(GreedyFill)
+      << false << 0 << 0 << lines("// ");
+  QTest::newRow("joined")
+      << lines("aaa|bbb|ccc") << 20 << int(GreedyFill)
+      << true << 0 << 3 << lines("aaa bbb ccc");
+  QTest::newRow("unchanged head and tail")
+      << lines("aa bb|cc dd ee ff|gg hh") << 5 << int(GreedyFill)
+      << true << 1 << 1 << lines("aa bb|cc dd|ee ff|gg hh");
+  QTest::newRow("single /* line")
+      << lines("/* aaa bbb ccc") << 10 << int(GreedyFill)
+      << true << 0 << 1 << lines("/* aaa bbb| * ccc");
+  QTest::newRow("indented /** line")
+      << lines("  /** aaa bbb ccc") << 12 << int(GreedyFill)
+      << true << 0 << 1 << lines("  /** aaa|   * bbb ccc");
+  QTest::newRow("line comment")
+      << lines("// aaa bbb ccc ddd") << 10 << int(GreedyFill)
+      << true << 0 << 1 << lines("// aaa bbb|// ccc ddd");
+  QTest::newRow("second line prefix")
+      << lines("// aaa bbb ccc|//   ddd") << 12 << int(GreedyFill)
+      << true << 0 << 2 << lines("// aaa bbb|//   ccc ddd");
+  QTest::newRow("word longer than the fill column")
+      << lines("short averyveryverylongword end") << 10 << int(GreedyFill)
+      << true << 0 << 1 << lines("short|averyveryverylongword|end");
+  QTest::newRow("word longer than the fill column optimal")
+      << lines("short averyveryverylongword end") << 10 << int(OptimalFill)
+      << true << 0 << 1 << lines("short|averyveryverylongword|end");
+  QTest::newRow("greedy")
+      << lines("aaa bb cc ddddd") << 6 << int(GreedyFill)
+      << true << 0 << 1 << lines("aaa bb|cc|ddddd");
+  QTest::newRow("optimal")
+      << lines("aaa bb cc ddddd") << 6 << int(OptimalFill)
+      << true << 0 << 1 << lines("aaa|bb cc|ddddd");
+}
+
+void EmacsModePlugin::test_fillParagraph()
+{
+  QFETCH(QStringList, lines);
+  QFETCH(int, fillColumn);
+  QFETCH(int, mode);
+  QFETCH(bool, changed);
+  QFETCH(int, first);
+  QFETCH(int, count);
+  QFETCH(QStringList, filled);
+
+  int replacedFirst = -1;
+  int replacedCount = -1;
+  QStringList replacement;
+  QCOMPARE(fillParagraph(lines, QLatin1String("//"), fillColumn, 8, FillMode(mode),
+                         &replacedFirst, &replacedCount, &replacement), changed);
+  if (!changed)
+    return;
+
+  QCOMPARE(replacedFirst, first);
+  QCOMPARE(replacedCount, count);
+  QVERIFY(replacedCount > 0);
+  QStringList result = lines.mid(0, replacedFirst);
+  result += replacement;
+  result += lines.mid(replacedFirst + replacedCount);
+  QCOMPARE(result, filled);
+
+  // filling the result again changes nothing
+  QVERIFY(!fillParagraph(result, QLatin1String("//"), fillColumn, 8, FillMode(mode),
+                         &replacedFirst, &replacedCount, &replacement));
+}
+
+void EmacsModePlugin::test_sortLines_data()
+{
+  QTest::addColumn<int>("count");
+  QTest::addColumn<bool>("numeric");
+  QTest::addColumn<bool>("descending");
+
+  // 100000 lines are above ParallelSortThreshold, sorted in chunks and
+  // merged
+  for (int count : {1000, 100000}) {
+    for (bool numeric : {false, true}) {
+      for (bool descending : {false, true}) {
+        const QByteArray name = QByteArray::number(count)
+            + (numeric ? " numeric" : " text") + (descending ? " descending" : "");
+        QTest::newRow(name.constData()) << count << numeric << descending;
+      }
+    }
+  }
+}
+
+// Few distinct keys, so that stability shows.
+void EmacsModePlugin::test_sortLines()
+{
+  QFETCH(int, count);
+  QFETCH(bool, numeric);
+  QFETCH(bool, descending);
+
+  QRandomGenerator generator(count);
+  QVector<int> keys;
+  QStringList lines;
+  for (int i = 0; i < count; ++i) {
+    keys.append(generator.bounded(-500, 500));
+    lines.append(QString::fromLatin1("key %1 line").arg(keys.last()));
+  }
+  const QString text = lines.join(QLatin1Char('\n'));
+  const QVector<LineSpan> original = splitLines(text);
+  QCOMPARE(original.size(), count);
+
+  QVector<int> expected(count);
+  std::iota(expected.begin(), expected.end(), 0);
+  std::stable_sort(expected.begin(), expected.end(), [&](int a, int b) {
+    if (numeric)
+      return descending ? keys.at(a) > keys.at(b) : keys.at(a) < keys.at(b);
+    const int result = lines.at(a).compare(lines.at(b));
+    return descending ? result > 0 : result < 0;
+  });
+
+  QVector<LineSpan> sorted = original;
+  sortLines(text, &sorted, numeric, descending);
+  QCOMPARE(sorted.size(), count);
+  for (int i = 0; i < count; ++i)
+    QCOMPARE(sorted.at(i).begin_, original.at(expected.at(i)).begin_);
+
+  QVERIFY(!sameLines(text, sorted, original));
+  QVector<LineSpan> again = sorted;
+  sortLines(text, &again, numeric, descending);
+  QVERIFY(sameLines(text, again, sorted));
+}
+
+void EmacsModePlugin::test_sameLines()
+{
+  const QString text = QLatin1String("b\na\na\nc");
+  const QVector<LineSpan> original = splitLines(text);
+  QVector<LineSpan> lines = original;
+  QVERIFY(sameLines(text, lines, original));
+
+  // equal lines swapped leave the text as it was
+  std::swap(lines[1], lines[2]);
+  QVERIFY(sameLines(text, lines, original));
+  QCOMPARE(joinLines(text, lines), text);
+
+  std::swap(lines[0], lines[1]);
+  QVERIFY(!sameLines(text, lines, original));
+  QCOMPARE(joinLines(text, lines), QLatin1String("a\nb\na\nc"));
+
+  lines = original;
+  lines.removeLast();
+  QVERIFY(!sameLines(text, lines, original));
+}
+
+void EmacsModePlugin::test_largeFileModeFollowsEdits()
+{
+  Utils::SavedAction *maxLineLength = theEmacsModeSetting(ConfigLargeFileLineLength);
+  const QVariant oldMaxLineLength = maxLineLength->value();
+  maxLineLength->setValue(100);
+
+  QPlainTextEdit editor(QString::fromLatin1("short\nlines\n"));
+  EmacsModeHandler handler(&editor);
+  QSignalSpy changes(&handler, SIGNAL(largeFileModeChanged(bool)));
+  handler.updateLargeFileMode();
+  QVERIFY(!handler.isLargeFileMode());
+
+  // a line growing past the limit switches once the indexes are flushed
+  QTextCursor cursor(editor.document());
+  cursor.movePosition(QTextCursor::NextBlock);
+  cursor.insertText(QString(200, QLatin1Char('x')));
+  QVERIFY(!handler.isLargeFileMode());
+  handler.flushIndexUpdates();
+  QVERIFY(handler.isLargeFileMode());
+
+  cursor.movePosition(QTextCursor::StartOfBlock);
+  cursor.movePosition(QTextCursor::EndOfBlock, QTextCursor::KeepAnchor);
+  cursor.removeSelectedText();
+  handler.flushIndexUpdates();
+  QVERIFY(!handler.isLargeFileMode());
+
+  // replacing the whole document is checked too
+  editor.setPlainText(QString(200, QLatin1Char('y')));
+  handler.flushIndexUpdates();
+  QVERIFY(handler.isLargeFileMode());
+
+  maxLineLength->setValue(oldMaxLineLength);
+
+  QCOMPARE(changes.count(), 3);
+  QCOMPARE(changes.at(0).at(0).toBool(), true);
+  QCOMPARE(changes.at(1).at(0).toBool(), false);
+  QCOMPARE(changes.at(2).at(0).toBool(), true);
+}
+
+// A word used often in one buffer ranks above one used once in each of
+// two buffers, and follows the edits.
+void EmacsModePlugin::test_symbolRanking()
+{
+  QTextDocument first(QString::fromLatin1("foo foo\nfoo fob"));
+  QTextDocument second(QString::fromLatin1("fob"));
+  SymbolDictionary dictionary;
+  WordIndex firstIndex;
+  firstIndex.setDocument(&first);
+  firstIndex.setDictionary(&dictionary);
+  firstIndex.ensureBuilt();
+  WordIndex secondIndex;
+  secondIndex.setDocument(&second);
+  secondIndex.setDictionary(&dictionary);
+  secondIndex.ensureBuilt();
+
+  const QString prefix = QString::fromLatin1("fo");
+  QCOMPARE(dictionary.completions(prefix), QStringList() << QLatin1String("foo") << QLatin1String("fob"));
+
+  int blockCount = first.blockCount();
+  connect(&first, &QTextDocument::contentsChange, [&](int position, int, int charsAdded) {
+    firstIndex.update(BlockChange(&first, position, charsAdded, blockCount));
+    blockCount = first.blockCount();
+  });
+  QTextCursor cursor(&first);
+  cursor.movePosition(QTextCursor::NextBlock, QTextCursor::KeepAnchor);
+  cursor.removeSelectedText();
+  QCOMPARE(first.toPlainText(), QString::fromLatin1("foo fob"));
+  QCOMPARE(dictionary.completions(prefix), QStringList() << QLatin1String("fob") << QLatin1String("foo"));
+
+  cursor.insertText(QString::fromLatin1("foo foo foo "));
+  QCOMPARE(dictionary.completions(prefix), QStringList() << QLatin1String("foo") << QLatin1String("fob"));
+
+  // a dropped buffer takes its occurrences along
+  firstIndex.clear();
+  QCOMPARE(dictionary.completions(prefix), QStringList() << QLatin1String("fob"));
+}
+
+// Counts depth over every kind of bracket, like the index, and checks
+// the kind only at the end.
+static int referenceMatchingBracket(const QString &text, int pos)
+{
+  const auto isOpen = [](QChar c) {
+    return c == QLatin1Char('(') || c == QLatin1Char('[') || c == QLatin1Char('{');
+  };
+  const auto isClose = [](QChar c) {
+    return c == QLatin1Char(')') || c == QLatin1Char(']') || c == QLatin1Char('}');
+  };
+  const QChar c = text.at(pos);
+  if (!isOpen(c) && !isClose(c))
+    return -1;
+  const int step = isOpen(c) ? 1 : -1;
+  int depth = 0;
+  for (int i = pos + step; i >= 0 && i < text.size(); i += step) {
+    if (isOpen(text.at(i)) || isClose(text.at(i)))
+      depth += (isOpen(text.at(i)) ? 1 : -1) * step;
+    if (depth < 0) {
+      const QString pair = isOpen(c) ? QString(c) + text.at(i) : QString(text.at(i)) + c;
+      return pair == QLatin1String("()") || pair == QLatin1String("[]")
+          || pair == QLatin1String("{}") ? i : -1;
+    }
+  }
+  return -1;
+}
+
+// Several hundred blocks, most without brackets, so matches are found
+// across whole spans of blocks in both directions.
+void EmacsModePlugin::test_bracketMatching()
+{
+  static const char alphabet[] = "(([[{{)]}a ";
+  QRandomGenerator generator(7);
+  QStringList lines;
+  for (int i = 0; i < 1500; ++i) {
+    QString line;
+    if (generator.bounded(4) == 0) {
+      for (int n = generator.bounded(8); n > 0; --n)
+        line += QLatin1Char(alphabet[generator.bounded(int(sizeof(alphabet)) - 1)]);
+    } else {
+      line = QLatin1String("text");
+    }
+    lines.append(line);
+  }
+  QTextDocument document(lines.join(QLatin1Char('\n')));
+  BracketIndex brackets;
+  brackets.setDocument(&document);
+
+  int blockCount = document.blockCount();
+  connect(&document, &QTextDocument::contentsChange, [&](int position, int, int charsAdded) {
+    brackets.update(BlockChange(&document, position, charsAdded, blockCount));
+    blockCount = document.blockCount();
+  });
+
+  const auto compareAll = [&]() {
+    const QString text = document.toPlainText();
+    for (int pos = 0; pos < text.size(); ++pos) {
+      const QByteArray where = QByteArray("at ") + QByteArray::number(pos);
+      QVERIFY2(brackets.matchingBracket(pos) == referenceMatchingBracket(text, pos),
+               where.constData());
+    }
+  };
+
+  compareAll();
+  if (QTest::currentTestFailed())
+    return;
+
+  // edits invalidate the span summaries
+  QTextCursor cursor(&document);
+  cursor.setPosition(document.findBlockByNumber(100).position());
+  cursor.insertText(QString::fromLatin1("((\n"));
+  compareAll();
+  if (QTest::currentTestFailed())
+    return;
+  cursor.setPosition(document.findBlockByNumber(1200).position());
+  cursor.insertText(QString::fromLatin1("}}]"));
+  compareAll();
+  if (QTest::currentTestFailed())
+    return;
+  cursor.setPosition(document.findBlockByNumber(10).position());
+  cursor.setPosition(document.findBlockByNumber(700).position(), QTextCursor::KeepAnchor);
+  cursor.removeSelectedText();
+  compareAll();
+}
+
+}
+}
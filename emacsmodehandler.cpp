@@ -41,14 +41,20 @@
 #include <utils/qtcassert.h>
 
 #include <QtCore/QDebug>
+#include <QtCore/QDir>
 #include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QFutureWatcher>
+#include <QtCore/QMetaMethod>
 #include <QtCore/QObject>
 #include <QtCore/QPointer>
 #include <QtCore/QProcess>
 #include <QtCore/QRegExp>
 #include <QtCore/QTextStream>
 #include <QtCore/QtAlgorithms>
+#include <QtCore/QSet>
 #include <QtCore/QStack>
+#include <QtConcurrent/QtConcurrentRun>
 
 #include <QApplication>
 #include <QtGui/QKeyEvent>
@@ -58,14 +64,27 @@
 #include <QtGui/QTextBlock>
 #include <QtGui/QTextCursor>
 #include <QtGui/QTextDocumentFragment>
+#include <QtGui/QTextLayout>
 #include <QTextEdit>
 
+#include <algorithm>
 #include <climits>
+#include <memory>
 #include <ctype.h>
 
 #include "pluginstate.hpp"
 #include "action.hpp"
 #include "range.hpp"
+#include "blockchange.hpp"
+#include "textscan.hpp"
+#include "rectangle.hpp"
+#include "fill.hpp"
+#include "whitespace.hpp"
+#include "sortlines.hpp"
+#include "shellcommand.hpp"
+#include "documentwriter.hpp"
+#include "autosave.hpp"
+#include "filecompletion.hpp"
 
 using namespace Utils;
 
@@ -82,6 +101,23 @@ namespace Internal {
 
 const int ParagraphSeparator = 0x00002029;
 
+// Upper bound for numeric prefix arguments.
+const int MaxRepeatCount = 1000000;
+
+// Quiet period after an edit in large-file mode before the indexes catch up.
+const int IndexUpdateDelay = 500;
+
+// Deferred edits spread over more blocks than this are not worth
+// replaying, the indexes are dropped and rebuilt when next needed.
+const int MaxPendingBlocks = 10000;
+
+// Completions listed after the text of a file name prompt.
+const int MaxShownCompletions = 8;
+
+// Characters of shell command output written to the output pane, which
+// slows down badly on more.
+const int MaxShownShellOutput = 1024 * 1024;
+
 using namespace Qt;
 
 PluginState EmacsModeHandler::pluginState;
@@ -100,10 +136,20 @@ EmacsModeHandler::EmacsModeHandler(QWidget *widget, QObject *parent)
   init();
   
   if (editor()) {
+    blockCount_ = document()->blockCount();
+    wordIndex_.setDocument(document());
+    wordIndex_.setDictionary(&pluginState.symbols_);
+    blankLines_.setDocument(document());
+    brackets_.setDocument(document());
+    lines_.setDocument(document());
     connect(EDITOR(document()), SIGNAL(contentsChange(int,int,int)),
             SLOT(onContentsChanged(int,int,int)));
     connect(EDITOR(document()), SIGNAL(undoCommandAdded()), SLOT(onUndoCommandAdded()));
   }
+
+  indexTimer_.setSingleShot(true);
+  indexTimer_.setInterval(IndexUpdateDelay);
+  connect(&indexTimer_, SIGNAL(timeout()), SLOT(flushIndexUpdates()));
 }
 
 bool EmacsModeHandler::eventFilter(QObject *ob, QEvent *ev)
@@ -129,9 +175,19 @@ bool EmacsModeHandler::eventFilter(QObject *ob, QEvent *ev)
 }
 
 void EmacsModeHandler::startNewKillBufferEntryIfNecessary() {
-  if ((lastActionId_ != Action::Id::KillLine) &&
-      (lastActionId_ != Action::Id::KillSymbol) &&
-      (lastActionId_ != Action::Id::KillSelected)) {
+  startNewKillBufferEntryIfNecessary(lastActionId_);
+}
+
+void EmacsModeHandler::startNewKillBufferEntryIfNecessary(Action::Id previousActionId) {
+  if ((previousActionId != Action::Id::KillLine) &&
+      (previousActionId != Action::Id::KillSymbol) &&
+      (previousActionId != Action::Id::KillSelected) &&
+      (previousActionId != Action::Id::KillWord) &&
+      (previousActionId != Action::Id::BackwardKillWord) &&
+      (previousActionId != Action::Id::KillParagraph) &&
+      (previousActionId != Action::Id::KillSexp) &&
+      (previousActionId != Action::Id::ZapToChar) &&
+      (previousActionId != Action::Id::ZapUpToChar)) {
     pluginState.killRing_.push("");
   }
 }
@@ -147,6 +203,14 @@ QTextBlock EmacsModeHandler::block() const {
 void EmacsModeHandler::setCurrentFileName(const QString &fileName)
 {
   currentFileName_ = fileName;
+  if (!editor() || fileName.isEmpty())
+    return;
+  AutoSaveJournal::forDocument(document())->setFileName(fileName);
+
+  const QFileInfo journal(AutoSaveJournal::journalName(fileName));
+  if (journal.exists() && journal.lastModified() >= QFileInfo(fileName).lastModified())
+    showMessage(MessageWarning, EmacsModeHandler::tr("%1 has auto save data; Ctrl-x x a recovers it")
+                .arg(QFileInfo(fileName).fileName()));
 }
 
 QWidget *EmacsModeHandler::widget()
@@ -204,6 +268,7 @@ QTextDocument *EmacsModeHandler::document() const {
 
 void EmacsModeHandler::setupWidget()
 {
+  emit largeFileModeChanged(largeFileMode_);
   updateMiniBuffer();
 }
 
@@ -219,6 +284,94 @@ void EmacsModeHandler::onContentsChanged(int position, int charsRemoved, int cha
     setUndoPosition(position);
     recordCursorPosition_ = false;
   }
+
+  cachedBlockNumber_ = -1;
+  updateNarrowing(position, charsRemoved, charsAdded);
+
+  BlockChange change(document(), position, charsAdded, blockCount_);
+  blockCount_ = document()->blockCount();
+
+  if (!largeFileMode_) {
+    updateIndexes(change);
+    if (mayExceedLargeFileLimits(change)) {
+      largeFileCheckPending_ = true;
+      indexTimer_.start();
+    }
+    return;
+  }
+
+  if (hasPendingChange_)
+    pendingChange_.merge(change);
+  else
+    pendingChange_ = change;
+  hasPendingChange_ = true;
+  if (pendingChange_.addedBlocks_ > MaxPendingBlocks)
+    pendingChange_ = BlockChange();
+  // the document may have dropped below the limits
+  largeFileCheckPending_ = true;
+  indexTimer_.start();
+}
+
+void EmacsModeHandler::updateIndexes(const BlockChange &change)
+{
+  wordIndex_.update(change);
+  blankLines_.update(change);
+  brackets_.update(change);
+}
+
+void EmacsModeHandler::flushIndexUpdates()
+{
+  flushReplayedEdits();
+  indexTimer_.stop();
+  if (hasPendingChange_) {
+    hasPendingChange_ = false;
+    updateIndexes(pendingChange_);
+  }
+  if (largeFileCheckPending_) {
+    largeFileCheckPending_ = false;
+    updateLargeFileMode();
+  }
+}
+
+void EmacsModeHandler::updateLargeFileMode()
+{
+  const int maxSize = config(ConfigLargeFileSize).toInt();
+  const int maxLineLength = config(ConfigLargeFileLineLength).toInt();
+
+  bool large = document()->characterCount() > maxSize;
+  // block lengths are known without copying or laying out the text
+  for (QTextBlock block = document()->begin(); !large && block.isValid(); block = block.next())
+    large = block.length() - 1 > maxLineLength;
+
+  if (large == largeFileMode_)
+    return;
+
+  flushIndexUpdates();
+  largeFileMode_ = large;
+  emit largeFileModeChanged(large);
+  showMessage(large ? MessageWarning : MessageInfo, large
+              ? EmacsModeHandler::tr("Large file mode")
+              : EmacsModeHandler::tr("Large file mode disabled"));
+}
+
+bool EmacsModeHandler::mayExceedLargeFileLimits(const BlockChange &change) const
+{
+  if (document()->characterCount() > config(ConfigLargeFileSize).toInt())
+    return true;
+  if (!change.isValid())
+    return true;
+  const int maxLineLength = config(ConfigLargeFileLineLength).toInt();
+  QTextBlock block = document()->findBlockByNumber(change.firstBlock_);
+  for (int i = 0; i < change.addedBlocks_ && block.isValid(); ++i, block = block.next()) {
+    if (block.length() - 1 > maxLineLength)
+      return true;
+  }
+  return false;
+}
+
+bool EmacsModeHandler::logicalLines() const
+{
+  return largeFileMode_ || !hasConfig(ConfigLineMoveVisual);
 }
 
 void EmacsModeHandler::onUndoCommandAdded()
@@ -241,6 +394,7 @@ void EmacsModeHandler::init()
   shortcuts_.push_back(Shortcut("<META>|<SHIFT>|<UNDERSCORE>", Action(Action::Id::Undo, std::bind(&EmacsModeHandler::undoAction, this))));
   shortcuts_.push_back(Shortcut("<TAB>", Action(Action::Id::IndentRegion, std::bind(&EmacsModeHandler::indentRegionAction, this))));
   shortcuts_.push_back(Shortcut("<META>|<SPACE>", Action(Action::Id::StartSelection, std::bind(&EmacsModeHandler::startSelectionAction, this))));
+  shortcuts_.push_back(Shortcut("<META>|g", Action(Action::Id::KeyboardQuit, std::bind(&EmacsModeHandler::keyboardQuitAction, this))));
   shortcuts_.push_back(Shortcut("<ESC>|<ESC>", Action(Action::Id::CancelCurrentCommand, std::bind(&EmacsModeHandler::cancelCurrentCommandAction, this))));
   shortcuts_.push_back(Shortcut("<META>|w", Action(Action::Id::KillSelected, std::bind(&EmacsModeHandler::killSelectedAction, this))));
   shortcuts_.push_back(Shortcut("<ALT>|w", Action(Action::Id::CopySelected, std::bind(&EmacsModeHandler::copySelectedAction, this))));
@@ -250,16 +404,90 @@ void EmacsModeHandler::init()
   shortcuts_.push_back(Shortcut("<META>|d", Action(Action::Id::KillSymbol, std::bind(&EmacsModeHandler::killSymbolAction, this))));
   shortcuts_.push_back(Shortcut("<META>|y", Action(Action::Id::YankCurrent, std::bind(&EmacsModeHandler::yankCurrentAction, this))));
   shortcuts_.push_back(Shortcut("<ALT>|y", Action(Action::Id::YankNext, std::bind(&EmacsModeHandler::yankNextAction, this))));
+  shortcuts_.push_back(Shortcut("<META>|x|f", Action(Action::Id::FindFile, std::bind(&EmacsModeHandler::findFileAction, this))));
   shortcuts_.push_back(Shortcut("<META>|x|s", Action(Action::Id::SaveCurrentBuffer, std::bind(&EmacsModeHandler::saveCurrentFileAction, this))));
+  shortcuts_.push_back(Shortcut("<META>|x x a", Action(Action::Id::RecoverThisFile, std::bind(&EmacsModeHandler::recoverThisFileAction, this))));
+  shortcuts_.push_back(Shortcut("<META>|x s", Action(Action::Id::SaveSomeBuffers, std::bind(&EmacsModeHandler::saveSomeBuffersAction, this))));
+  shortcuts_.push_back(Shortcut("<META>|x r k", Action(Action::Id::KillRectangle, std::bind(&EmacsModeHandler::killRectangleAction, this))));
+  shortcuts_.push_back(Shortcut("<META>|x r y", Action(Action::Id::YankRectangle, std::bind(&EmacsModeHandler::yankRectangleAction, this))));
+  shortcuts_.push_back(Shortcut("<META>|x r t", Action(Action::Id::StringRectangle, std::bind(&EmacsModeHandler::stringRectangleAction, this))));
+  shortcuts_.push_back(Shortcut("<META>|x r o", Action(Action::Id::OpenRectangle, std::bind(&EmacsModeHandler::openRectangleAction, this))));
+  shortcuts_.push_back(Shortcut("<META>|x r c", Action(Action::Id::ClearRectangle, std::bind(&EmacsModeHandler::clearRectangleAction, this))));
   shortcuts_.push_back(Shortcut("<META>|i|c", Action(Action::Id::CommentOutRegion, std::bind(&EmacsModeHandler::commentOutRegionAction, this))));
   shortcuts_.push_back(Shortcut("<META>|i|u", Action(Action::Id::UncommentRegion, std::bind(&EmacsModeHandler::uncommentRegionAction, this))));
+  shortcuts_.push_back(Shortcut("<ALT>|;", Action(Action::Id::CommentDwim, std::bind(&EmacsModeHandler::commentDwimAction, this))));
+  shortcuts_.push_back(Shortcut("<ALT>|q", Action(Action::Id::FillParagraph, std::bind(&EmacsModeHandler::fillParagraphAction, this))));
+  shortcuts_.push_back(Shortcut("<META>|x f", Action(Action::Id::SetFillColumn, std::bind(&EmacsModeHandler::setFillColumnAction, this))));
+  shortcuts_.push_back(Shortcut("<META>|x w d", Action(Action::Id::DeleteTrailingWhitespace, std::bind(&EmacsModeHandler::deleteTrailingWhitespaceAction, this))));
+  shortcuts_.push_back(Shortcut("<META>|x w u", Action(Action::Id::Untabify, std::bind(&EmacsModeHandler::untabifyAction, this))));
+  shortcuts_.push_back(Shortcut("<META>|x w t", Action(Action::Id::Tabify, std::bind(&EmacsModeHandler::tabifyAction, this))));
+  shortcuts_.push_back(Shortcut("<META>|x w c", Action(Action::Id::WhitespaceCleanup, std::bind(&EmacsModeHandler::whitespaceCleanupAction, this))));
+  shortcuts_.push_back(Shortcut("<META>|x x s", Action(Action::Id::SortLines, std::bind(&EmacsModeHandler::sortLinesAction, this, false))));
+  shortcuts_.push_back(Shortcut("<META>|x x n", Action(Action::Id::SortNumericLines, std::bind(&EmacsModeHandler::sortLinesAction, this, true))));
+  shortcuts_.push_back(Shortcut("<META>|x x r", Action(Action::Id::ReverseRegion, std::bind(&EmacsModeHandler::reverseRegionAction, this))));
+  shortcuts_.push_back(Shortcut("<ALT>|<SHIFT>|<BAR>", Action(Action::Id::ShellCommandOnRegion, std::bind(&EmacsModeHandler::shellCommandOnRegionAction, this))));
+  shortcuts_.push_back(Shortcut("<META>|x <SHIFT>|(", Action(Action::Id::StartMacro, std::bind(&EmacsModeHandler::startMacroAction, this))));
+  shortcuts_.push_back(Shortcut("<META>|x <SHIFT>|)", Action(Action::Id::EndMacro, std::bind(&EmacsModeHandler::endMacroAction, this))));
+  shortcuts_.push_back(Shortcut("<META>|x e", Action(Action::Id::CallMacro, std::bind(&EmacsModeHandler::callMacroAction, this))));
+  shortcuts_.push_back(Shortcut("<META>|x|k r", Action(Action::Id::ApplyMacroToRegionLines, std::bind(&EmacsModeHandler::applyMacroToRegionLinesAction, this))));
+  shortcuts_.push_back(Shortcut("<META>|x|k a", Action(Action::Id::BroadcastToRegionLines, std::bind(&EmacsModeHandler::broadcastToRegionLinesAction, this))));
+  shortcuts_.push_back(Shortcut("<META>|x n n", Action(Action::Id::NarrowToRegion, std::bind(&EmacsModeHandler::narrowToRegionAction, this))));
+  shortcuts_.push_back(Shortcut("<META>|x n w", Action(Action::Id::Widen, std::bind(&EmacsModeHandler::widenAction, this))));
+  shortcuts_.push_back(Shortcut("<META>|x x d", Action(Action::Id::DeleteDuplicateLines, std::bind(&EmacsModeHandler::deleteDuplicateLinesAction, this))));
+  shortcuts_.push_back(Shortcut("<ALT>|f", Action(Action::Id::ForwardWord, std::bind(&EmacsModeHandler::forwardWordAction, this))));
+  shortcuts_.push_back(Shortcut("<ALT>|b", Action(Action::Id::BackwardWord, std::bind(&EmacsModeHandler::backwardWordAction, this))));
+  shortcuts_.push_back(Shortcut("<ALT>|d", Action(Action::Id::KillWord, std::bind(&EmacsModeHandler::killWordAction, this))));
+  shortcuts_.push_back(Shortcut("<ALT>|<BACKSPACE>", Action(Action::Id::BackwardKillWord, std::bind(&EmacsModeHandler::backwardKillWordAction, this))));
+  shortcuts_.push_back(Shortcut("<ALT>|<SHIFT>|<BRACERIGHT>", Action(Action::Id::ForwardParagraph, std::bind(&EmacsModeHandler::forwardParagraphAction, this))));
+  shortcuts_.push_back(Shortcut("<ALT>|<SHIFT>|<BRACELEFT>", Action(Action::Id::BackwardParagraph, std::bind(&EmacsModeHandler::backwardParagraphAction, this))));
+  shortcuts_.push_back(Shortcut("<ALT>|h", Action(Action::Id::MarkParagraph, std::bind(&EmacsModeHandler::markParagraphAction, this))));
+  shortcuts_.push_back(Shortcut("<ALT>|k", Action(Action::Id::KillParagraph, std::bind(&EmacsModeHandler::killParagraphAction, this))));
+  shortcuts_.push_back(Shortcut("<META>|<ALT>|f", Action(Action::Id::ForwardSexp, std::bind(&EmacsModeHandler::forwardSexpAction, this))));
+  shortcuts_.push_back(Shortcut("<META>|<ALT>|b", Action(Action::Id::BackwardSexp, std::bind(&EmacsModeHandler::backwardSexpAction, this))));
+  shortcuts_.push_back(Shortcut("<META>|<ALT>|u", Action(Action::Id::BackwardUpList, std::bind(&EmacsModeHandler::backwardUpListAction, this))));
+  shortcuts_.push_back(Shortcut("<META>|<ALT>|k", Action(Action::Id::KillSexp, std::bind(&EmacsModeHandler::killSexpAction, this))));
+  shortcuts_.push_back(Shortcut("<META>|v", Action(Action::Id::ScrollUp, std::bind(&EmacsModeHandler::scrollUpAction, this))));
+  shortcuts_.push_back(Shortcut("<ALT>|v", Action(Action::Id::ScrollDown, std::bind(&EmacsModeHandler::scrollDownAction, this))));
+  shortcuts_.push_back(Shortcut("<META>|l", Action(Action::Id::RecenterTopBottom, std::bind(&EmacsModeHandler::recenterTopBottomAction, this))));
+  shortcuts_.push_back(Shortcut("<ALT>|g g", Action(Action::Id::GotoLine, std::bind(&EmacsModeHandler::gotoLineAction, this))));
+  shortcuts_.push_back(Shortcut("<ALT>|g|g", Action(Action::Id::GotoLine, std::bind(&EmacsModeHandler::gotoLineAction, this))));
+  shortcuts_.push_back(Shortcut("<ALT>|g c", Action(Action::Id::GotoChar, std::bind(&EmacsModeHandler::gotoCharAction, this))));
+  shortcuts_.push_back(Shortcut("<ALT>|g <TAB>", Action(Action::Id::MoveToColumn, std::bind(&EmacsModeHandler::moveToColumnAction, this))));
+  shortcuts_.push_back(Shortcut("<ALT>|z", Action(Action::Id::ZapToChar, std::bind(&EmacsModeHandler::zapToCharAction, this, true))));
+  shortcuts_.push_back(Shortcut("<ALT>|<SHIFT>|z", Action(Action::Id::ZapUpToChar, std::bind(&EmacsModeHandler::zapToCharAction, this, false))));
+  shortcuts_.push_back(Shortcut("<ALT>|g f", Action(Action::Id::JumpToChar, std::bind(&EmacsModeHandler::jumpToCharAction, this))));
+  shortcuts_.push_back(Shortcut("<META>|u", Action(Action::Id::UniversalArgument, std::bind(&EmacsModeHandler::universalArgumentAction, this))));
+  shortcuts_.push_back(Shortcut("<ALT>|-", Action(Action::Id::NegativeArgument, std::bind(&EmacsModeHandler::negativeArgumentAction, this))));
+  shortcuts_.push_back(Shortcut("<ALT>|0", Action(Action::Id::DigitArgument, std::bind(&EmacsModeHandler::digitArgumentAction, this, 0))));
+  shortcuts_.push_back(Shortcut("<ALT>|1", Action(Action::Id::DigitArgument, std::bind(&EmacsModeHandler::digitArgumentAction, this, 1))));
+  shortcuts_.push_back(Shortcut("<ALT>|2", Action(Action::Id::DigitArgument, std::bind(&EmacsModeHandler::digitArgumentAction, this, 2))));
+  shortcuts_.push_back(Shortcut("<ALT>|3", Action(Action::Id::DigitArgument, std::bind(&EmacsModeHandler::digitArgumentAction, this, 3))));
+  shortcuts_.push_back(Shortcut("<ALT>|4", Action(Action::Id::DigitArgument, std::bind(&EmacsModeHandler::digitArgumentAction, this, 4))));
+  shortcuts_.push_back(Shortcut("<ALT>|5", Action(Action::Id::DigitArgument, std::bind(&EmacsModeHandler::digitArgumentAction, this, 5))));
+  shortcuts_.push_back(Shortcut("<ALT>|6", Action(Action::Id::DigitArgument, std::bind(&EmacsModeHandler::digitArgumentAction, this, 6))));
+  shortcuts_.push_back(Shortcut("<ALT>|7", Action(Action::Id::DigitArgument, std::bind(&EmacsModeHandler::digitArgumentAction, this, 7))));
+  shortcuts_.push_back(Shortcut("<ALT>|8", Action(Action::Id::DigitArgument, std::bind(&EmacsModeHandler::digitArgumentAction, this, 8))));
+  shortcuts_.push_back(Shortcut("<ALT>|9", Action(Action::Id::DigitArgument, std::bind(&EmacsModeHandler::digitArgumentAction, this, 9))));
+  shortcuts_.push_back(Shortcut("<ALT>|<SLASH>", Action(Action::Id::DabbrevExpand, std::bind(&EmacsModeHandler::dabbrevExpandAction, this))));
+  shortcuts_.push_back(Shortcut("<META>|<ALT>|<SLASH>", Action(Action::Id::HippieExpand, std::bind(&EmacsModeHandler::hippieExpandAction, this))));
 }
 
 void EmacsModeHandler::saveCurrentFileAction()
 {
+  prepareToSave();
   saveToFile(currentFileName_);
 }
 
+void EmacsModeHandler::prepareToSave()
+{
+  if (hasConfig(ConfigDeleteTrailingWhitespaceOnSave)) {
+    int beginLine = 0;
+    int endLine = 0;
+    narrowedLines(&beginLine, &endLine);
+    fixWhitespace(DeleteTrailingWhitespace, beginLine, endLine);
+  }
+}
+
 void EmacsModeHandler::moveToFirstNonBlankOnLine()
 {
   moveToFirstNonBlankOnLine(&tc_);
@@ -273,363 +501,1756 @@ void EmacsModeHandler::moveToFirstNonBlankOnLine(QTextCursor *tc)
 
 void EmacsModeHandler::moveToNonBlankOnLine(QTextCursor *tc)
 {
-  QTextDocument *doc = tc->document();
   const QTextBlock block = tc->block();
-  const int maxPos = block.position() + block.length() - 1;
-  int i = tc->position();
-  while (doc->characterAt(i).isSpace() && i < maxPos)
-    ++i;
-  tc->setPosition(i, QTextCursor::KeepAnchor);
+  const QString &text = blockText(block);
+  const int column = skipForward(text.constData(), text.size(),
+                                 tc->position() - block.position(), BlankChars);
+  tc->setPosition(block.position() + column, QTextCursor::KeepAnchor);
 }
 
 QChar const EmacsModeHandler::firstNonBlankOnLine(int line)
 {
-  QString const s = lineContents(line);
-  int i = 0;
-  while (i < s.size() && s.at(i).isSpace())
-    ++i;
-  if (i != s.size())
-    return s.at(i);
-  else
-    return QChar();
+  const QString &text = blockText(document()->findBlockByNumber(line - 1));
+  const int column = firstNonBlank(text);
+  return column == text.size() ? QChar() : text.at(column);
 }
 
 void EmacsModeHandler::commentOutRegionAction()
 {
-  int beginLine = lineForPosition(tc_.anchor());
-  int endLine = lineForPosition(tc_.position());
-
-  if (tc_.atBlockStart() && tc_.atBlockEnd())
-    if (beginLine > endLine)
-      ++endLine;
-    else
-      --endLine;
-
-  if (beginLine > endLine)
-    qSwap(beginLine, endLine);
-
-  /// find out whether we need to uncomment it
-  int firstPos = firstPositionInLine(beginLine);
-
-  beginEditBlock(firstPos);
-
-  for (int line = beginLine; line <= endLine; ++line) {
-    setPosition(firstPositionInLine(line));
-    tc_.insertText(QString::fromLatin1("//"));
-  }
-  endEditBlock();
-
-  setPosition(firstPos);
-  //    moveToFirstNonBlankOnLine();
+  commentRegion(CommentLines);
 }
 
 void EmacsModeHandler::uncommentRegionAction()
 {
-  int beginLine = lineForPosition(tc_.anchor());
-  int endLine = lineForPosition(tc_.position());
+  commentRegion(UncommentLines);
+}
 
-  if (tc_.atBlockStart() && tc_.atBlockEnd())
-    if (beginLine > endLine)
-      ++endLine;
-    else
-      --endLine;
+void EmacsModeHandler::commentDwimAction()
+{
+  commentRegion(ToggleComment);
+}
 
-  if (beginLine > endLine)
-    qSwap(beginLine, endLine);
+// Lines spanned by the region, the current line without one. A region
+// ending at the start of a line does not include that line.
+void EmacsModeHandler::regionLines(int *beginLine, int *endLine) const
+{
+  lines_.linesForPositions(tc_.anchor(), tc_.position(), beginLine, endLine);
+  if (*beginLine > *endLine)
+    qSwap(*beginLine, *endLine);
+
+  const int end = qMax(tc_.anchor(), tc_.position());
+  if (*endLine > *beginLine && end == firstPositionInLine(*endLine))
+    --*endLine;
+}
 
+// Comments or uncomments the region's lines in a single pass over the
+// blocks and a single undo step. Blank lines are left alone, so the
+// region counts as commented when every other line starts with the
+// comment token.
+void EmacsModeHandler::commentRegion(CommentMode mode)
+{
+  QString token = QString::fromLatin1("//");
+  emit commentTokenRequested(&token);
+  if (token.isEmpty()) {
+    showMessage(MessageWarning, EmacsModeHandler::tr("No comment syntax is defined"));
+    return;
+  }
 
-  /// find out whether we need to uncomment it
-  int firstPos = firstPositionInLine(beginLine);
+  int beginLine = 0;
+  int endLine = 0;
+  regionLines(&beginLine, &endLine);
+  const QTextBlock first = document()->findBlockByNumber(beginLine - 1);
+
+  auto isCommented = [&token](const QString &text) {
+    const int column = firstNonBlank(text);
+    return text.midRef(column, token.size()) == token;
+  };
+
+  if (mode == ToggleComment) {
+    mode = UncommentLines;
+    QTextBlock block = first;
+    for (int line = beginLine; line <= endLine && block.isValid(); ++line, block = block.next()) {
+      const QString text = block.text();
+      if (!isBlank(text) && !isCommented(text)) {
+        mode = CommentLines;
+        break;
+      }
+    }
+  }
 
+  const int firstPos = first.position();
   beginEditBlock(firstPos);
 
-  for (int line = beginLine; line <= endLine; ++line) {
-    setPosition(firstPositionInLine(line));
-    tc_.deleteChar();
-    tc_.deleteChar();
+  QTextCursor cursor(document());
+  QTextBlock block = first;
+  for (int line = beginLine; line <= endLine && block.isValid(); ++line, block = block.next()) {
+    const QString text = block.text();
+    if (isBlank(text))
+      continue;
+    if (mode == CommentLines) {
+      cursor.setPosition(block.position());
+      cursor.insertText(token);
+    } else if (isCommented(text)) {
+      const int column = firstNonBlank(text);
+      cursor.setPosition(block.position() + column);
+      cursor.setPosition(block.position() + column + token.size(), QTextCursor::KeepAnchor);
+      cursor.removeSelectedText();
+    }
   }
   endEditBlock();
 
   setPosition(firstPos);
-  //    moveToFirstNonBlankOnLine();
 }
 
-int EmacsModeHandler::lineNumber(const QTextBlock &block) const
+// Fills the paragraph at the cursor, or every paragraph in the region.
+// Only the lines that come out different are rewritten, all of them in
+// one undo step, and nothing is touched when the text is already filled.
+void EmacsModeHandler::fillParagraphAction()
 {
-  if (block.isVisible())
-    return block.firstLineNumber() + 1;
-
-  // Folded block has line number of the nearest previous visible line.
-  QTextBlock block2 = block;
-  while (block2.isValid() && !block2.isVisible())
-    block2 = block2.previous();
-  return block2.firstLineNumber() + 1;
-}
+  QString token = QString::fromLatin1("//");
+  emit commentTokenRequested(&token);
 
-QString EmacsModeHandler::selectText(const Range &range) const
-{
-  if (range.rangemode_ == RangeCharMode) {
-    QTextCursor tc(document());
-    tc.setPosition(range.beginPos_, QTextCursor::MoveAnchor);
-    tc.setPosition(range.endPos_, QTextCursor::KeepAnchor);
-    return tc.selection().toPlainText();
-  }
-  if (range.rangemode_ == RangeLineMode) {
-    QTextCursor tc(document());
-    int firstPos = firstPositionInLine(lineForPosition(range.beginPos_));
-    int lastLine = lineForPosition(range.endPos_);
-    int lastDocumentLine = document()->blockCount();
-    bool endOfDoc = lastLine == lastDocumentLine;
-    int lastPos = endOfDoc ? lastPositionInDocument() : firstPositionInLine(lastLine + 1);
-    tc.setPosition(firstPos, QTextCursor::MoveAnchor);
-    tc.setPosition(lastPos, QTextCursor::KeepAnchor);
-    QString contents = tc.selection().toPlainText();
-    return contents;// + QLatin1String(endOfDoc ? "\n" : "");
-  }
-  // FIXME: Performance?
-  int beginLine = lineForPosition(range.beginPos_);
-  int endLine = lineForPosition(range.endPos_);
-  int beginColumn = 0;
-  int endColumn = INT_MAX;
-  if (range.rangemode_ == RangeBlockMode) {
-    int column1 = range.beginPos_ - firstPositionInLine(beginLine);
-    int column2 = range.endPos_ - firstPositionInLine(endLine);
-    beginColumn = qMin(column1, column2);
-    endColumn = qMax(column1, column2);
+  int minLine = 0;
+  int maxLine = 0;
+  narrowedLines(&minLine, &maxLine);
+  QVector<QPair<int, int> > paragraphs;
+  int beginLine = 0;
+  int endLine = 0;
+  if (moveMode_ == QTextCursor::KeepAnchor && tc_.hasSelection()) {
+    regionLines(&minLine, &maxLine);
+    for (int line = minLine; line <= maxLine; ++line) {
+      if (paragraphLines(token, line, minLine, maxLine, &beginLine, &endLine)) {
+        paragraphs.append(qMakePair(beginLine, endLine));
+        line = endLine;
+      }
+    }
+  } else if (paragraphLines(token, cursorLine() + 1, minLine, maxLine, &beginLine, &endLine)) {
+    paragraphs.append(qMakePair(beginLine, endLine));
   }
-  int len = endColumn - beginColumn + 1;
-  QString contents;
-  QTextBlock block = document()->findBlockByNumber(beginLine - 1);
-  for (int i = beginLine; i <= endLine && block.isValid(); ++i) {
-    QString line = block.text();
-    if (range.rangemode_ == RangeBlockMode) {
-      line = line.mid(beginColumn, len);
-      if (line.size() < len)
-        line += QString(len - line.size(), QLatin1Char(' '));
-    }
-    contents += line;
-    if (!contents.endsWith(QLatin1Char('\n')))
-      contents += QLatin1Char('\n');
-    block = block.next();
+  if (paragraphs.isEmpty()) {
+    showMessage(MessageInfo, EmacsModeHandler::tr("Nothing to fill"));
+    return;
   }
-  //qDebug() << "SELECTED: " << contents;
-  return contents;
-}
 
-void EmacsModeHandler::saveToFile(QString const & fileName)
-{
-  int beginLine = 0;
-  int endLine = linesInDocument();
-  QFile file1(fileName);
-  bool exists = file1.exists();
-  if (file1.open(QIODevice::ReadWrite))
-  {
-    file1.close();
-    QTextCursor tc = tc_;
-    Range range(firstPositionInLine(beginLine),
-                firstPositionInLine(endLine), RangeLineMode);
-    QString contents = selectText(range);
-    tc_ = tc;
-    bool handled = false;
-    emit writeFileRequested(&handled, fileName, contents);
-    // nobody cared, so act ourselves
-    if (!handled) {
-      QFile::remove(fileName);
-      QFile file2(fileName);
-      if (file2.open(QIODevice::ReadWrite)) {
-        QTextStream ts(&file2);
-        ts << contents;
-        ts.flush();
-      } else {
-        qDebug() << QString::fromLatin1("Cannot open file '%1' for writing").arg(fileName);
-        showMessage(MessageError, EmacsModeHandler::tr
-                    ("Cannot open file '%1' for writing").arg(fileName));
-      }
+  const int fillColumn = config(ConfigFillColumn).toInt();
+  const int tabSize = config(ConfigTabStop).toInt();
+  const FillMode mode = hasConfig(ConfigFillOptimal) ? OptimalFill : GreedyFill;
+
+  struct Edit { int firstLine; int lineCount; QStringList lines; };
+  QVector<Edit> edits;
+  for (const auto &paragraph : paragraphs) {
+    QStringList lines;
+    QTextBlock block = document()->findBlockByNumber(paragraph.first - 1);
+    for (int line = paragraph.first; line <= paragraph.second; ++line, block = block.next())
+      lines.append(block.text());
+    Edit edit;
+    if (fillParagraph(lines, token, fillColumn, tabSize, mode,
+                      &edit.firstLine, &edit.lineCount, &edit.lines)) {
+      edit.firstLine += paragraph.first;
+      edits.append(edit);
     }
-    // check result by reading back
-    QFile file3(fileName);
-    file3.open(QIODevice::ReadOnly);
-    QByteArray ba = file3.readAll();
-    showMessage(MessageInfo, EmacsModeHandler::tr("\"%1\" %2 %3L, %4C written")
-                .arg(fileName).arg(exists ? QString::fromLatin1(" ") : QString::fromLatin1(" [New] "))
-                .arg(ba.count('\n')).arg(ba.size()));
   }
-  else
-  {
-    showMessage(MessageError, EmacsModeHandler::tr
-                ("Cannot open file '%1' for reading").arg(fileName));
+  if (edits.isEmpty())
+    return;
+
+  beginEditBlock(tc_.position());
+  QTextCursor cursor(document());
+  // bottom up, so the line numbers of the edits above stay valid
+  for (int i = edits.size() - 1; i >= 0; --i) {
+    const Edit &edit = edits.at(i);
+    const QTextBlock first = document()->findBlockByNumber(edit.firstLine - 1);
+    cursor.setPosition(first.position());
+    const QTextBlock last = document()->findBlockByNumber(edit.firstLine + edit.lineCount - 2);
+    if (edit.lines.isEmpty()) {
+      cursor.setPosition(last.next().position(), QTextCursor::KeepAnchor);
+      cursor.removeSelectedText();
+    } else {
+      cursor.setPosition(last.position() + last.length() - 1, QTextCursor::KeepAnchor);
+      cursor.insertText(edit.lines.join(QLatin1Char('\n')));
+    }
   }
+  endEditBlock();
 }
 
-void EmacsModeHandler::copySelectedAction()
+// Sets the fill column to the prefix argument, or to the cursor's column.
+void EmacsModeHandler::setFillColumnAction()
 {
-  pluginState.killRing_.push("");
-  pluginState.killRing_.appendTop(tc_.selectedText());
-  anchorCurrentPos();
-  setMoveMode(QTextCursor::MoveAnchor);
+  const int column = hasPrefixArg_
+      ? repeatCount()
+      : columnAt(blockText(tc_.block()), tc_.positionInBlock(), config(ConfigTabStop).toInt());
+  if (column < 1) {
+    showMessage(MessageError, EmacsModeHandler::tr("Invalid fill column %1").arg(column));
+    return;
+  }
+  theEmacsModeSetting(ConfigFillColumn)->setValue(column);
+  showMessage(MessageInfo, EmacsModeHandler::tr("Fill column set to %1").arg(column));
 }
 
-void EmacsModeHandler::killSelectedAction()
+// Lines of the paragraph at line within [minLine, maxLine]: the lines
+// around it with the same kind of fill prefix and something after it.
+// Outside of comments only plain text documents, which have no comment
+// token, are filled.
+bool EmacsModeHandler::paragraphLines(const QString &token, int line, int minLine, int maxLine,
+                                      int *beginLine, int *endLine) const
 {
-  startNewKillBufferEntryIfNecessary();
-  pluginState.killRing_.appendTop(tc_.selectedText());
-  tc_.removeSelectedText();
-  anchorCurrentPos();
-  setMoveMode(QTextCursor::MoveAnchor);
-}
-
-void EmacsModeHandler::killSymbolAction()
+  const QTextBlock block = document()->findBlockByNumber(line - 1);
+  const FillPrefixKind kind = fillPrefixKind(blockText(block), token);
+  if (kind == NoFillPrefix || (kind == TextPrefix && !token.isEmpty()))
+    return false;
+
+  *beginLine = line;
+  for (QTextBlock b = block.previous();
+       *beginLine > minLine && fillPrefixKind(blockText(b), token) == kind; b = b.previous())
+    --*beginLine;
+  *endLine = line;
+  for (QTextBlock b = block.next();
+       *endLine < maxLine && fillPrefixKind(blockText(b), token) == kind; b = b.next())
+    ++*endLine;
+  return true;
+}
+
+void EmacsModeHandler::deleteTrailingWhitespaceAction()
 {
-  startNewKillBufferEntryIfNecessary();
-
-  tc_.setPosition(tc_.position(), QTextCursor::MoveAnchor);
-  tc_.movePosition(QTextCursor::NextCharacter, QTextCursor::KeepAnchor);
-  pluginState.killRing_.appendTop(tc_.selectedText());
-
-  tc_.removeSelectedText();
+  fixWhitespaceInRegion(DeleteTrailingWhitespace);
 }
 
-void EmacsModeHandler::cleanKillRing()
+void EmacsModeHandler::untabifyAction()
 {
-  pluginState.killRing_.clear();
+  fixWhitespaceInRegion(Untabify);
 }
 
-void EmacsModeHandler::yankCurrentAction()
+void EmacsModeHandler::tabifyAction()
 {
-  if (!pluginState.killRing_.empty()) {
-    startYankPosition_ = tc_.position();
-    tc_.insertText(pluginState.killRing_.current());
-    endYankPosition_ = tc_.position();
-  }
+  fixWhitespaceInRegion(TabifyIndentation);
 }
 
-void EmacsModeHandler::yankNextAction() {
-  if ((lastActionId_ == Action::Id::YankCurrent) || ((lastActionId_ == Action::Id::YankNext) && isValidYankChain_)) {
-    tc_.setPosition(startYankPosition_, QTextCursor::MoveAnchor);
-    tc_.setPosition(endYankPosition_, QTextCursor::KeepAnchor);
-    tc_.removeSelectedText();
-    pluginState.killRing_.advance();
-    isValidYankChain_ = true;
-    yankCurrentAction();
-  } else {
-    showMessage(MessageError, EmacsModeHandler::tr("Previous command wasn't yank!"));
-  }
+// Trailing white space goes, indentation follows the "Expand tabulators"
+// setting.
+void EmacsModeHandler::whitespaceCleanupAction()
+{
+  fixWhitespaceInRegion(DeleteTrailingWhitespace
+                        | (hasConfig(ConfigExpandTab) ? UntabifyIndentation : TabifyIndentation));
 }
 
-void EmacsModeHandler::killLineAction()
+// The region's lines, or the whole buffer when the mark is not active.
+void EmacsModeHandler::fixWhitespaceInRegion(int fixes)
 {
-  startNewKillBufferEntryIfNecessary();
-  bool isEndOfLine = (atEndOfLine() || (tc_.block().length() == 1));
-
-  if (!isEndOfLine)
-  {
-    tc_.setPosition(tc_.position(), QTextCursor::MoveAnchor);
-    tc_.movePosition(QTextCursor::EndOfLine, QTextCursor::KeepAnchor);
-    pluginState.killRing_.appendTop(tc_.selectedText());
-  }
+  int beginLine = 0;
+  int endLine = 0;
+  if (moveMode_ == QTextCursor::KeepAnchor && tc_.hasSelection())
+    regionLines(&beginLine, &endLine);
   else
-  {
-    tc_.setPosition(tc_.position(), QTextCursor::MoveAnchor);
-    tc_.movePosition(QTextCursor::NextCharacter, QTextCursor::KeepAnchor);
-    pluginState.killRing_.appendTop(tc_.selectedText());
-  }
-  tc_.removeSelectedText();
+    narrowedLines(&beginLine, &endLine);
+  fixWhitespace(fixes, beginLine, endLine);
 }
 
-void EmacsModeHandler::setMoveMode(QTextCursor::MoveMode moveMode)
+// One pass over the blocks collects every edit, which are then applied
+// back to front so that the collected positions stay valid, all in one
+// undo step. Clean lines cost a scan and nothing else.
+void EmacsModeHandler::fixWhitespace(int fixes, int beginLine, int endLine)
 {
-  moveMode_ = moveMode;
-}
-
-void EmacsModeHandler::startSelectionAction() {
-  anchorCurrentPos();
-  setMoveMode(QTextCursor::KeepAnchor);
-}
+  const int tabSize = config(ConfigTabStop).toInt();
+  QVector<WhitespaceEdit> edits;
+  QTextBlock block = document()->findBlockByNumber(beginLine - 1);
+  for (int line = beginLine; line <= endLine && block.isValid(); ++line, block = block.next())
+    whitespaceEdits(block.text(), block.position(), fixes, tabSize, &edits);
+  if (edits.isEmpty())
+    return;
 
-void EmacsModeHandler::cancelCurrentCommandAction() {
-  setMoveMode(QTextCursor::MoveAnchor);
-  anchorCurrentPos();
-  lastActionId_ = Action::Id::Null;
+  beginEditBlock(tc_.position());
+  QTextCursor cursor(document());
+  for (int i = edits.size() - 1; i >= 0; --i) {
+    const WhitespaceEdit &edit = edits.at(i);
+    cursor.setPosition(edit.begin_);
+    cursor.setPosition(edit.end_, QTextCursor::KeepAnchor);
+    if (edit.text_.isEmpty())
+      cursor.removeSelectedText();
+    else
+      cursor.insertText(edit.text_);
+  }
+  endEditBlock();
 }
 
-void EmacsModeHandler::anchorCurrentPos()
+// A prefix argument sorts in descending order.
+void EmacsModeHandler::sortLinesAction(bool numeric)
 {
-  tc_.setPosition(tc_.position(), QTextCursor::MoveAnchor);
+  const bool descending = hasPrefixArg_;
+  rearrangeLines([numeric, descending](const QString &text, QVector<LineSpan> *lines) {
+    sortLines(text, lines, numeric, descending);
+  });
 }
 
-bool EmacsModeHandler::wantsOverride(QKeyEvent *ev)
+void EmacsModeHandler::reverseRegionAction()
 {
-  TShortcutList shortcuts = partialShortcuts_.empty() ? shortcuts_ : partialShortcuts_;
-  for (TShortcutList::const_iterator it = shortcuts.begin(); it != shortcuts.end(); ++it)
-    if (it->isAccepted(ev))
-      return true;
-  return false;
+  rearrangeLines([](const QString &, QVector<LineSpan> *lines) {
+    std::reverse(lines->begin(), lines->end());
+  });
 }
 
-EventResult EmacsModeHandler::handleEvent(QKeyEvent *ev)
+// A prefix argument keeps the last of equal lines instead of the first.
+void EmacsModeHandler::deleteDuplicateLinesAction()
 {
-  tc_ = EDITOR(textCursor());
-  if (partialShortcuts_.empty())
-    partialShortcuts_ = shortcuts_;
-
-  TShortcutList newPartialShortcuts;
-  bool executed = false;
-  bool isAccepted = false;
-
-  for (TShortcutList::const_iterator it = partialShortcuts_.begin(); it != partialShortcuts_.end(); ++it)
-  {
-    if (it->isAccepted(ev))
-    {
-      isAccepted = true;
-      if (it->hasFollower(ev))
-        newPartialShortcuts.push_back(it->getFollower(ev));
-      else
-      {
-        it->exec();
-        lastActionId_ = it->actionId();
-        executed = true;
-        partialShortcuts_.clear();
-        break;
-      }
-    }
+  const bool keepLast = hasPrefixArg_;
+  int dropped = 0;
+  rearrangeLines([keepLast, &dropped](const QString &text, QVector<LineSpan> *lines) {
+    dropped = deleteDuplicateLines(text, lines, keepLast);
+  });
+  showMessage(MessageInfo, EmacsModeHandler::tr("Deleted %n duplicate line(s)", 0, dropped));
+}
+
+// Reads the region's lines once into a flat buffer, lets rearrange
+// reorder or drop them and writes the result back as one replacement.
+// Whether anything changed is decided on the spans, the replacement is
+// only built when it is needed.
+void EmacsModeHandler::rearrangeLines(
+    const std::function<void(const QString &, QVector<LineSpan> *)> &rearrange)
+{
+  int beginLine = 0;
+  int endLine = 0;
+  regionLines(&beginLine, &endLine);
+  const QTextBlock first = document()->findBlockByNumber(beginLine - 1);
+  const QTextBlock last = document()->findBlockByNumber(endLine - 1);
+  const int begin = first.position();
+  const int end = last.position() + last.length() - 1;
+
+  QString text;
+  text.reserve(end - begin);
+  for (QTextBlock block = first; block.isValid() && block.blockNumber() < endLine; block = block.next()) {
+    if (block != first)
+      text += QLatin1Char('\n');
+    text += block.text();
   }
 
-  if (!executed)
-    partialShortcuts_ = newPartialShortcuts;
+  const QVector<LineSpan> original = splitLines(text);
+  QVector<LineSpan> lines = original;
+  rearrange(text, &lines);
+  if (sameLines(text, lines, original))
+    return;
 
-  EDITOR(setTextCursor(tc_));
+  beginEditBlock(begin);
+  QTextCursor cursor(document());
+  cursor.setPosition(begin);
+  cursor.setPosition(end, QTextCursor::KeepAnchor);
+  cursor.insertText(joinLines(text, lines));
+  endEditBlock();
 
-  return isAccepted ? EventHandled : EventPassedToCore;
+  setPosition(begin);
 }
 
-void EmacsModeHandler::installEventFilter()
+bool EmacsModeHandler::isMacroCommand(Action::Id id) const
 {
-  EDITOR(installEventFilter(this));
+  return id == Action::Id::StartMacro || id == Action::Id::EndMacro
+      || id == Action::Id::CallMacro || id == Action::Id::ApplyMacroToRegionLines
+      || id == Action::Id::BroadcastToRegionLines || id == Action::Id::KeyboardQuit;
 }
 
-void EmacsModeHandler::setUndoPosition(int pos)
+// The action a key the editor handles would have, false for keys that
+// do not edit.
+bool EmacsModeHandler::recordCoreKey(QKeyEvent *ev, MacroStep *step)
 {
-  undoCursorPosition_[tc_.document()->availableUndoSteps()] = pos;
+  const int key = ev->key();
+  const QString text = ev->text();
+  if (key == Qt::Key_Return || key == Qt::Key_Enter)
+    step->action_ = Action(Action::Id::NewLine, std::bind(&EmacsModeHandler::newLineAction, this));
+  else if (key == Qt::Key_Backspace)
+    step->action_ = Action(Action::Id::Backspace, std::bind(&EmacsModeHandler::backspaceAction, this));
+  else if (key == Qt::Key_Delete)
+    step->action_ = Action(Action::Id::DeleteChar, [this] { tc_.deleteChar(); });
+  else if (!text.isEmpty() && text.at(0).isPrint())
+    step->action_ = Action(Action::Id::SelfInsert, [this, text] { tc_.insertText(text); });
+  else
+    return false;
+  return true;
 }
 
-void EmacsModeHandler::moveToEndOfLineAction()
+void EmacsModeHandler::startMacroAction()
 {
-  // does not work for "hidden" documents like in the autotests
-  tc_.movePosition(QTextCursor::EndOfLine, moveMode_);
+  recordedMacro_.clear();
+  recordingMacro_ = true;
+  showMessage(MessageInfo, EmacsModeHandler::tr("Defining kbd macro..."));
 }
 
-void EmacsModeHandler::moveToStartOfLineAction()
+void EmacsModeHandler::endMacroAction()
 {
-  // does not work for "hidden" documents like in the autotests
-  tc_.movePosition(QTextCursor::StartOfLine, moveMode_);
+  if (!recordingMacro_) {
+    showMessage(MessageError, EmacsModeHandler::tr("Not defining kbd macro"));
+    return;
+  }
+  recordingMacro_ = false;
+  macro_.swap(recordedMacro_);
+  recordedMacro_.clear();
+  showMessage(MessageInfo, EmacsModeHandler::tr("Keyboard macro defined"));
 }
 
-void EmacsModeHandler::updateMiniBuffer()
+// Runs the last macro as often as the prefix argument says, as one undo
+// step.
+void EmacsModeHandler::callMacroAction()
 {
-  if (!textedit_ && !plaintextedit_)
+  if (recordingMacro_) {
+    showMessage(MessageError, EmacsModeHandler::tr("Already defining kbd macro"));
     return;
-
-  QString msg;
+  }
+  if (macro_.empty()) {
+    showMessage(MessageError, EmacsModeHandler::tr("No kbd macro has been defined"));
+    return;
+  }
+  const int count = repeatCount();
+  clearPrefixArgument();
+  beginReplayBlock();
+  for (int i = 0; i < count; ++i)
+    replayMacro(macro_);
+  endReplayBlock();
+}
+
+void EmacsModeHandler::applyMacroToRegionLinesAction()
+{
+  if (macro_.empty()) {
+    showMessage(MessageError, EmacsModeHandler::tr("No kbd macro has been defined"));
+    return;
+  }
+  applyToRegionLines(macro_);
+}
+
+// The next command, or the next character typed, runs on every line of
+// the region instead of once.
+void EmacsModeHandler::broadcastToRegionLinesAction()
+{
+  broadcastNext_ = true;
+  showMessage(MessageShowCmd, EmacsModeHandler::tr("Apply to region lines: "));
+}
+
+// Runs the steps the way handleEvent would have run their keys.
+void EmacsModeHandler::replayMacro(const Macro &macro)
+{
+  replayingMacro_ = true;
+  for (const MacroStep &step : macro) {
+    replayAnswers_ = step.answers_;
+    step.action_.exec();
+    lastActionId_ = step.action_.id();
+    if (!isPrefixArgument(lastActionId_))
+      clearPrefixArgument();
+    // contentsChange is held back until the edit block ends
+    cachedBlockNumber_ = -1;
+  }
+  replayAnswers_.clear();
+  replayingMacro_ = false;
+}
+
+void EmacsModeHandler::beginReplayBlock()
+{
+  beginEditBlock(tc_.position());
+  replayUndoSteps_ = document()->availableUndoSteps();
+  inReplayBlock_ = true;
+}
+
+void EmacsModeHandler::endReplayBlock()
+{
+  inReplayBlock_ = false;
+  endEditBlock();
+}
+
+// Called before an index is read. Joining when the replay has not made
+// an undo step yet would merge it into the step before, so a new edit
+// block is begun instead.
+void EmacsModeHandler::flushReplayedEdits()
+{
+  if (!inReplayBlock_)
+    return;
+
+  // the undo position belongs to the whole replay
+  const bool recordCursorPosition = recordCursorPosition_;
+  const QMap<int, int> undoCursorPosition = undoCursorPosition_;
+  endEditBlock();
+  if (document()->availableUndoSteps() == replayUndoSteps_)
+    tc_.beginEditBlock();
+  else
+    joinPreviousEditBlock();
+  recordCursorPosition_ = recordCursorPosition;
+  undoCursorPosition_ = undoCursorPosition;
+}
+
+// Runs macro once on every line of the region, starting each line at the
+// display column the region starts at. The next line is found by walking
+// the blocks with a cursor that follows the edits. Everything is one edit
+// block and the editor is only repainted when it ends, index updates only
+// happen earlier for steps that read an index. A prefix argument given
+// before the command applies on every line.
+void EmacsModeHandler::applyToRegionLines(const Macro &macro)
+{
+  int beginLine = 0;
+  int endLine = 0;
+  regionLines(&beginLine, &endLine);
+  const int tabSize = config(ConfigTabStop).toInt();
+  const int regionStart = qMin(tc_.anchor(), tc_.position());
+  const QTextBlock first = document()->findBlock(regionStart);
+  const int column = columnAt(first.text(), regionStart - first.position(), tabSize);
+
+  const bool hasPrefixArg = hasPrefixArg_;
+  const bool prefixDigits = prefixDigits_;
+  const int prefixArg = prefixArg_;
+  const int prefixSign = prefixSign_;
+
+  setMoveMode(QTextCursor::MoveAnchor);
+  EDITOR(setUpdatesEnabled(false));
+  beginReplayBlock();
+
+  QTextCursor next(document());
+  QTextBlock block = first;
+  for (int line = beginLine; line <= endLine && block.isValid(); ++line) {
+    const bool hasNext = block.next().isValid();
+    if (hasNext)
+      next.setPosition(block.next().position());
+
+    tc_.setPosition(block.position() + indexAtColumn(block.text(), column, tabSize));
+    hasPrefixArg_ = hasPrefixArg;
+    prefixDigits_ = prefixDigits;
+    prefixArg_ = prefixArg;
+    prefixSign_ = prefixSign;
+    replayMacro(macro);
+
+    if (!hasNext)
+      break;
+    block = next.block();
+  }
+
+  endReplayBlock();
+  EDITOR(setUpdatesEnabled(true));
+  showMessage(MessageInfo, EmacsModeHandler::tr("Applied to lines %1-%2").arg(beginLine).arg(endLine));
+}
+
+// Pipes the region through a shell command. The output is shown, or
+// replaces the region with a prefix argument. The command runs in the
+// background, Ctrl-g kills it.
+void EmacsModeHandler::shellCommandOnRegionAction()
+{
+  const bool replace = hasPrefixArg_;
+  const int begin = qMin(tc_.anchor(), tc_.position());
+  const int end = qMax(tc_.anchor(), tc_.position());
+  readFromMiniBuffer(EmacsModeHandler::tr("Shell command on region: "),
+                     [this, replace, begin, end](const QString &command) {
+    if (command.trimmed().isEmpty())
+      return;
+    if (shellCommand_) {
+      showMessage(MessageError, EmacsModeHandler::tr("A shell command is already running"));
+      return;
+    }
+    shellReplace_ = replace;
+    shellCommand_ = new ShellCommand(document(), begin, end, command, this);
+    connect(shellCommand_, SIGNAL(finished(int,QString,QString)),
+            SLOT(onShellCommandFinished(int,QString,QString)));
+    showMessage(MessageInfo, EmacsModeHandler::tr("Running \"%1\"...").arg(command));
+    shellCommand_->start();
+  });
+}
+
+void EmacsModeHandler::onShellCommandFinished(int exitCode, const QString &output,
+                                              const QString &errors)
+{
+  ShellCommand *command = shellCommand_;
+  shellCommand_ = nullptr;
+  command->deleteLater();
+
+  if (exitCode != 0) {
+    const QString reason = errors.trimmed().section(QLatin1Char('\n'), 0, 0);
+    showMessage(MessageError, exitCode == -1
+                ? reason
+                : EmacsModeHandler::tr("Shell command exited with code %1: %2").arg(exitCode).arg(reason));
+    if (exitCode == -1 || shellReplace_)
+      return;
+  }
+
+  if (shellReplace_) {
+    QTextCursor cursor(document());
+    cursor.setPosition(command->begin());
+    cursor.setPosition(command->end(), QTextCursor::KeepAnchor);
+    cursor.beginEditBlock();
+    cursor.insertText(output);
+    cursor.endEditBlock();
+    showMessage(MessageInfo, QString());
+    return;
+  }
+
+  // a single line fits the minibuffer, more goes to the output pane
+  const int first = firstNonBlank(output);
+  const QStringRef trimmed = output.midRef(first, lastNonBlank(output) + 1 - first);
+  const int lines = trimmed.count(QLatin1Char('\n')) + 1;
+  if (trimmed.isEmpty()) {
+    if (exitCode == 0)
+      showMessage(MessageInfo, EmacsModeHandler::tr("(Shell command succeeded with no output)"));
+  } else if (lines == 1) {
+    showMessage(MessageInfo, trimmed.toString());
+  } else if (output.size() <= MaxShownShellOutput) {
+    emit shellOutputRequested(command->command(), output);
+    if (exitCode == 0)
+      showMessage(MessageInfo, EmacsModeHandler::tr("Shell command output: %n line(s)", 0, lines));
+  } else {
+    // whole lines up to the limit
+    const int cut = output.lastIndexOf(QLatin1Char('\n'), MaxShownShellOutput - 1);
+    const QStringRef shown = output.leftRef(cut < 0 ? MaxShownShellOutput : cut + 1);
+    const int shownLines = shown.count(QLatin1Char('\n'));
+    emit shellOutputRequested(command->command(), shown.toString()
+                              + EmacsModeHandler::tr("[Output truncated after %n line(s) of %1]", 0, shownLines)
+                              .arg(lines));
+    showMessage(MessageWarning, EmacsModeHandler::tr("Shell command output: %n line(s), truncated", 0, lines));
+  }
+}
+
+// Restricts the buffer to the region's lines. Nothing is copied, the
+// other blocks are only hidden.
+void EmacsModeHandler::narrowToRegionAction()
+{
+  int beginLine = 0;
+  int endLine = 0;
+  regionLines(&beginLine, &endLine);
+  if (narrowed_)
+    setOutsideBlocksVisible(true);
+
+  const QTextBlock first = document()->findBlockByNumber(beginLine - 1);
+  const QTextBlock last = document()->findBlockByNumber(endLine - 1);
+  narrowBegin_ = QTextCursor();
+  if (first.previous().isValid()) {
+    narrowBegin_ = QTextCursor(document());
+    narrowBegin_.setPosition(first.position() - 1);
+  }
+  narrowEnd_ = QTextCursor(document());
+  narrowEnd_.setPosition(last.position() + last.length() - 1);
+  narrowed_ = true;
+  setOutsideBlocksVisible(false);
+
+  setMoveMode(QTextCursor::MoveAnchor);
+  tc_.setPosition(clampToNarrowing(tc_.position()));
+  showMessage(MessageInfo, EmacsModeHandler::tr("Narrowed to lines %1-%2").arg(beginLine).arg(endLine));
+}
+
+void EmacsModeHandler::widenAction()
+{
+  if (!narrowed_)
+    return;
+  setOutsideBlocksVisible(true);
+  narrowed_ = false;
+  narrowBegin_ = QTextCursor();
+  narrowEnd_ = QTextCursor();
+}
+
+// Shows or hides the blocks around the accessible lines and lets the
+// layout account for them, the way folding does.
+void EmacsModeHandler::setOutsideBlocksVisible(bool visible)
+{
+  int beginLine = 0;
+  int endLine = 0;
+  narrowedLines(&beginLine, &endLine);
+  const QTextBlock first = document()->findBlockByNumber(beginLine - 1);
+  const QTextBlock last = document()->findBlockByNumber(endLine - 1);
+
+  auto update = [visible](QTextBlock block) {
+    block.setVisible(visible);
+    block.setLineCount(visible ? qMax(1, block.layout()->lineCount()) : 0);
+  };
+  for (QTextBlock block = document()->firstBlock(); block.isValid() && block != first; block = block.next())
+    update(block);
+  for (QTextBlock block = last.next(); block.isValid(); block = block.next())
+    update(block);
+
+  if (first.position() > 0)
+    document()->markContentsDirty(0, first.position());
+  const int end = last.position() + last.length();
+  if (end < document()->characterCount())
+    document()->markContentsDirty(end, document()->characterCount() - end);
+  EDITOR(viewport())->update();
+}
+
+// Edits made around the handler, like a reload or setPlainText, can
+// replace the accessible lines or add blocks outside them. The first
+// drop or cross the bounds and widen the buffer, new outside blocks are
+// hidden like the others.
+void EmacsModeHandler::updateNarrowing(int position, int charsRemoved, int charsAdded)
+{
+  if (!narrowed_)
+    return;
+
+  const bool replacedAll = position == 0 && charsRemoved > 0
+      && charsAdded >= document()->characterCount() - 1;
+  if (replacedAll || narrowedBegin() > narrowedEnd()
+      || (!narrowBegin_.isNull() && !narrowBegin_.atBlockEnd())) {
+    narrowed_ = false;
+    narrowBegin_ = QTextCursor();
+    narrowEnd_ = QTextCursor();
+    for (QTextBlock block = document()->firstBlock(); block.isValid(); block = block.next()) {
+      block.setVisible(true);
+      block.setLineCount(qMax(1, block.layout()->lineCount()));
+    }
+    document()->markContentsDirty(0, document()->characterCount());
+    EDITOR(viewport())->update();
+    showMessage(MessageWarning, EmacsModeHandler::tr("Widened, the accessible lines were replaced"));
+    return;
+  }
+
+  const int begin = narrowedBegin();
+  const int end = narrowedEnd();
+  const QTextBlock last = document()->findBlock(position + charsAdded);
+  for (QTextBlock block = document()->findBlock(position); block.isValid(); block = block.next()) {
+    const bool outside = block.position() + block.length() - 1 < begin || block.position() > end;
+    if (outside && block.isVisible()) {
+      block.setVisible(false);
+      block.setLineCount(0);
+      document()->markContentsDirty(block.position(), block.length());
+    }
+    if (block == last)
+      break;
+  }
+}
+
+int EmacsModeHandler::narrowedBegin() const
+{
+  return narrowed_ && !narrowBegin_.isNull() ? narrowBegin_.position() + 1 : 0;
+}
+
+int EmacsModeHandler::narrowedEnd() const
+{
+  return narrowed_ ? narrowEnd_.position() : lastPositionInDocument();
+}
+
+void EmacsModeHandler::narrowedLines(int *beginLine, int *endLine) const
+{
+  if (!narrowed_) {
+    *beginLine = 1;
+    *endLine = document()->blockCount();
+    return;
+  }
+  *beginLine = document()->findBlock(narrowedBegin()).blockNumber() + 1;
+  *endLine = document()->findBlock(narrowedEnd()).blockNumber() + 1;
+}
+
+int EmacsModeHandler::clampToNarrowing(int pos) const
+{
+  return narrowed_ ? qBound(narrowedBegin(), pos, narrowedEnd()) : pos;
+}
+
+// Run after every command, so that motions, jumps and yanks cannot leave
+// the accessible lines.
+void EmacsModeHandler::keepCursorInNarrowing()
+{
+  if (!narrowed_)
+    return;
+  const int anchor = clampToNarrowing(tc_.anchor());
+  const int position = clampToNarrowing(tc_.position());
+  if (anchor != tc_.anchor() || position != tc_.position()) {
+    tc_.setPosition(anchor);
+    tc_.setPosition(position, QTextCursor::KeepAnchor);
+  }
+}
+
+// Emacs' auto-fill: typing a blank past the fill column breaks the line
+// at the last blank before it and continues it with the line's prefix.
+void EmacsModeHandler::autoFill()
+{
+  const int tabSize = config(ConfigTabStop).toInt();
+  const int fillColumn = config(ConfigFillColumn).toInt();
+  const QTextBlock block = tc_.block();
+  const QString &text = blockText(block);
+  const int positionInBlock = tc_.position() - block.position();
+  if (columnAt(text, positionInBlock, tabSize) <= fillColumn)
+    return;
+
+  QString token = QString::fromLatin1("//");
+  emit commentTokenRequested(&token);
+  FillPrefixKind kind;
+  const int prefixLength = fillPrefixLength(text, token, &kind);
+  if (kind == TextPrefix && !token.isEmpty())
+    return;
+
+  // the word crossing the fill column moves to the next line
+  const int limit = qMin(indexAtColumn(text, fillColumn, tabSize) + 1, positionInBlock);
+  const int wordStart = skipBackward(text.constData(), limit, NonBlankChars);
+  const int blankStart = skipBackward(text.constData(), wordStart, BlankChars);
+  if (blankStart <= prefixLength)
+    return; // a single long word
+
+  QString prefix = text.left(prefixLength);
+  if (kind == BlockCommentPrefix && prefix.midRef(firstNonBlank(prefix), 2) == QLatin1String("/*"))
+    prefix = prefix.left(firstNonBlank(prefix)) + QLatin1String(" * ");
+  QTextCursor cursor(document());
+  cursor.setPosition(block.position() + blankStart);
+  cursor.setPosition(block.position() + wordStart, QTextCursor::KeepAnchor);
+  cursor.insertText(QLatin1Char('\n') + prefix);
+}
+
+int EmacsModeHandler::lineNumber(const QTextBlock &block) const
+{
+  if (block.isVisible())
+    return block.firstLineNumber() + 1;
+
+  // Folded block has line number of the nearest previous visible line.
+  QTextBlock block2 = block;
+  while (block2.isValid() && !block2.isVisible())
+    block2 = block2.previous();
+  return block2.firstLineNumber() + 1;
+}
+
+QString EmacsModeHandler::selectText(const Range &range) const
+{
+  if (range.rangemode_ == RangeCharMode) {
+    QTextCursor tc(document());
+    tc.setPosition(range.beginPos_, QTextCursor::MoveAnchor);
+    tc.setPosition(range.endPos_, QTextCursor::KeepAnchor);
+    return tc.selection().toPlainText();
+  }
+  if (range.rangemode_ == RangeLineMode && largeFileMode_) {
+    // avoid the intermediate QTextDocumentFragment copy
+    const int beginLine = lineForPosition(range.beginPos_);
+    const int endLine = lineForPosition(range.endPos_);
+    QString contents;
+    contents.reserve(firstPositionInLine(endLine) - firstPositionInLine(beginLine)
+                     + document()->findBlockByNumber(endLine - 1).length());
+    forEachLine(beginLine, endLine, [&contents](const QString &line) { contents += line; });
+    return contents;
+  }
+  if (range.rangemode_ == RangeLineMode) {
+    QTextCursor tc(document());
+    int firstPos = firstPositionInLine(lineForPosition(range.beginPos_));
+    int lastLine = lineForPosition(range.endPos_);
+    int lastDocumentLine = document()->blockCount();
+    bool endOfDoc = lastLine == lastDocumentLine;
+    int lastPos = endOfDoc ? lastPositionInDocument() : firstPositionInLine(lastLine + 1);
+    tc.setPosition(firstPos, QTextCursor::MoveAnchor);
+    tc.setPosition(lastPos, QTextCursor::KeepAnchor);
+    QString contents = tc.selection().toPlainText();
+    return contents;// + QLatin1String(endOfDoc ? "\n" : "");
+  }
+  const int beginLine = lineForPosition(range.beginPos_);
+  const int endLine = lineForPosition(range.endPos_);
+  if (range.rangemode_ == RangeBlockMode) {
+    // display columns, the column at endPos_ is included
+    const int tabSize = config(ConfigTabStop).toInt();
+    const QTextBlock first = document()->findBlock(range.beginPos_);
+    const QTextBlock last = document()->findBlock(range.endPos_);
+    const int column1 = columnAt(first.text(), range.beginPos_ - first.position(), tabSize);
+    const int column2 = columnAt(last.text(), range.endPos_ - last.position(), tabSize);
+    return extractRectangle(beginLine, endLine, qMin(column1, column2), qMax(column1, column2) + 1);
+  }
+
+  // whole lines, each ending in a newline
+  QString contents;
+  contents.reserve(firstPositionInLine(endLine) - firstPositionInLine(beginLine)
+                   + document()->findBlockByNumber(endLine - 1).length());
+  forEachLine(beginLine, endLine, [&contents](const QString &line) { contents += line; });
+  if (!contents.endsWith(QLatin1Char('\n')))
+    contents += QLatin1Char('\n');
+  return contents;
+}
+
+// Rows of the rectangle, each padded to its width and ending in a
+// newline, collected into one preallocated string.
+QString EmacsModeHandler::extractRectangle(int beginLine, int endLine,
+                                           int beginColumn, int endColumn) const
+{
+  const int tabSize = config(ConfigTabStop).toInt();
+  QString contents;
+  contents.reserve((endLine - beginLine + 1) * (endColumn - beginColumn + 1));
+  QTextBlock block = document()->findBlockByNumber(beginLine - 1);
+  for (int line = beginLine; line <= endLine && block.isValid(); ++line, block = block.next()) {
+    appendRectangleRow(&contents, block.text(), beginColumn, endColumn, tabSize);
+    contents += QLatin1Char('\n');
+  }
+  return contents;
+}
+
+// Feeds the lines in [beginLine, endLine] to sink one at a time, each
+// with its line break except for the last line of the document.
+void EmacsModeHandler::forEachLine(int beginLine, int endLine,
+                                   const std::function<void(const QString &)> &sink) const
+{
+  QTextBlock block = document()->findBlockByNumber(beginLine - 1);
+  QString line;
+  for (int i = beginLine; i <= endLine && block.isValid(); ++i) {
+    line = block.text();
+    block = block.next();
+    if (block.isValid())
+      line += QLatin1Char('\n');
+    sink(line);
+  }
+}
+
+void EmacsModeHandler::saveToFile(QString const & fileName)
+{
+  // the whole contents are only built for a listener that wants them
+  if (isSignalConnected(QMetaMethod::fromSignal(&EmacsModeHandler::writeFileRequested))) {
+    QString contents;
+    contents.reserve(document()->characterCount());
+    forEachLine(1, linesInDocument(), [&contents](const QString &line) { contents += line; });
+    bool handled = false;
+    emit writeFileRequested(&handled, fileName, contents);
+    if (handled) {
+      showMessage(MessageInfo, EmacsModeHandler::tr("\"%1\" %2L, %3C written")
+                  .arg(fileName).arg(contents.count(QLatin1Char('\n'))).arg(contents.size()));
+      return;
+    }
+  }
+
+  showMessage(MessageInfo, EmacsModeHandler::tr("Saving \"%1\"...").arg(fileName));
+  QPointer<EmacsModeHandler> self(this);
+  writeInBackground(fileName, [self](const WriteResult &result) {
+    if (!self)
+      return;
+    if (!result.error_.isEmpty()) {
+      self->showMessage(MessageError, result.error_);
+      return;
+    }
+    const QString written = EmacsModeHandler::tr("\"%1\" %2 %3L, %4C written")
+        .arg(result.fileName_)
+        .arg(result.created_ ? QString::fromLatin1(" [New] ") : QString::fromLatin1(" "))
+        .arg(result.lines_).arg(result.bytes_);
+    if (!result.backupError_.isEmpty())
+      self->showMessage(MessageWarning, EmacsModeHandler::tr("%1 (%2)").arg(written, result.backupError_));
+    else
+      self->showMessage(MessageInfo, written);
+  });
+}
+
+// Saves a snapshot of the document in the background, editing can go
+// on while it is written. The buffer is marked unmodified if it has not
+// changed by the time the write finishes.
+void EmacsModeHandler::writeInBackground(const QString &fileName,
+                                         const std::function<void(const WriteResult &)> &done)
+{
+  const int revision = document()->revision();
+  // the backup is shared by all editors of the document
+  QPointer<AutoSaveJournal> journal(AutoSaveJournal::forDocument(document()));
+  const bool backup = hasConfig(ConfigMakeBackupFiles) && !journal->isBackedUp();
+  QPointer<EmacsModeHandler> self(this);
+  DocumentSaver::instance()->save(fileName, documentText(document()), backup,
+                                  [self, journal, revision, done](const WriteResult &result) {
+    if (journal && result.backedUp_)
+      journal->setBackedUp();
+    if (self && result.error_.isEmpty() && self->document()->revision() == revision) {
+      self->document()->setModified(false);
+      AutoSaveJournal::forDocument(self->document())->discard();
+    }
+    done(result);
+  });
+}
+
+// Replaces the buffer with the text rebuilt from its auto-save file.
+// The journal is read and replayed on a worker thread, the replacement
+// is a single undo step.
+void EmacsModeHandler::recoverThisFileAction()
+{
+  const QString journal = AutoSaveJournal::journalName(currentFileName_);
+  if (currentFileName_.isEmpty() || !QFileInfo::exists(journal)) {
+    showMessage(MessageError, EmacsModeHandler::tr("No auto-save data for this buffer"));
+    return;
+  }
+  readCharFromMiniBuffer(EmacsModeHandler::tr("Recover auto save file %1? (y or n) ").arg(journal),
+                         [this, journal](const QString &input) {
+    if (input != QLatin1String("y"))
+      return;
+    showMessage(MessageInfo, EmacsModeHandler::tr("Recovering from %1...").arg(journal));
+    auto *watcher = new QFutureWatcher<RecoveredText>(this);
+    connect(watcher, SIGNAL(finished()), SLOT(onRecoveryFinished()));
+    watcher->setFuture(QtConcurrent::run([journal]() {
+      RecoveredText recovered;
+      AutoSaveJournal::replay(journal, &recovered.text_, &recovered.error_);
+      return recovered;
+    }));
+  });
+}
+
+void EmacsModeHandler::onRecoveryFinished()
+{
+  auto *watcher = static_cast<QFutureWatcher<RecoveredText> *>(sender());
+  const RecoveredText recovered = watcher->result();
+  watcher->deleteLater();
+  if (!recovered.error_.isEmpty()) {
+    showMessage(MessageError, recovered.error_);
+    return;
+  }
+
+  // the accessible lines are replaced with everything else
+  widenAction();
+  QTextCursor cursor(document());
+  cursor.setPosition(0);
+  cursor.setPosition(document()->characterCount() - 1, QTextCursor::KeepAnchor);
+  cursor.beginEditBlock();
+  cursor.insertText(recovered.text_);
+  cursor.endEditBlock();
+  setPosition(qMin(tc_.position(), document()->characterCount() - 1));
+  showMessage(MessageInfo, EmacsModeHandler::tr("Recovered %1").arg(currentFileName_));
+}
+
+// Offers each modified buffer for saving, then writes the confirmed
+// ones side by side.
+void EmacsModeHandler::saveSomeBuffersAction()
+{
+  QList<EmacsModeHandler *> handlers;
+  emit modifiedBuffersRequested(&handlers);
+  if (handlers.isEmpty()) {
+    showMessage(MessageInfo, EmacsModeHandler::tr("(No files need saving)"));
+    return;
+  }
+  QList<QPointer<EmacsModeHandler> > remaining;
+  for (EmacsModeHandler *handler : handlers)
+    remaining.append(handler);
+  askToSaveBuffers(remaining, QList<QPointer<EmacsModeHandler> >());
+}
+
+// y saves the buffer, n skips it, ! saves it and all the rest, . saves
+// it and stops asking, q stops asking.
+void EmacsModeHandler::askToSaveBuffers(const QList<QPointer<EmacsModeHandler> > &remaining,
+                                        const QList<QPointer<EmacsModeHandler> > &confirmed)
+{
+  QList<QPointer<EmacsModeHandler> > rest = remaining;
+  while (!rest.isEmpty() && !rest.first())
+    rest.removeFirst();
+  if (rest.isEmpty()) {
+    saveBuffers(confirmed);
+    return;
+  }
+
+  const QString prompt = EmacsModeHandler::tr("Save file %1? (y, n, !, ., q) ")
+      .arg(rest.first()->currentFileName_);
+  readCharFromMiniBuffer(prompt, [this, rest, confirmed](const QString &input) {
+    QList<QPointer<EmacsModeHandler> > next = rest;
+    QList<QPointer<EmacsModeHandler> > accepted = confirmed;
+    const QPointer<EmacsModeHandler> handler = next.takeFirst();
+    if (input == QLatin1String("y") || input == QLatin1String(" ")) {
+      accepted.append(handler);
+    } else if (input == QLatin1String("!")) {
+      accepted += rest;
+      next.clear();
+    } else if (input == QLatin1String(".")) {
+      accepted.append(handler);
+      next.clear();
+    } else if (input == QLatin1String("q") || input == QLatin1String("\n")) {
+      next.clear();
+    } else if (input != QLatin1String("n")) {
+      next = rest; // ask again
+    }
+    askToSaveBuffers(next, accepted);
+  });
+}
+
+// All writes are started at once, DocumentSaver bounds how many run at
+// the same time. One message sums up the results.
+void EmacsModeHandler::saveBuffers(const QList<QPointer<EmacsModeHandler> > &handlers)
+{
+  struct Summary
+  {
+    int pending = 0;
+    int saved = 0;
+    QStringList errors;
+  };
+  auto summary = std::make_shared<Summary>();
+  QPointer<EmacsModeHandler> self(this);
+  auto report = [self, summary]() {
+    if (!self)
+      return;
+    if (!summary->errors.isEmpty())
+      self->showMessage(MessageError, EmacsModeHandler::tr("Saved %n file(s), failed: %1", 0, summary->saved)
+                        .arg(summary->errors.join(QLatin1String("; "))));
+    else if (summary->saved)
+      self->showMessage(MessageInfo, EmacsModeHandler::tr("Saved %n file(s)", 0, summary->saved));
+    else
+      self->showMessage(MessageInfo, EmacsModeHandler::tr("(No files need saving)"));
+  };
+
+  QSet<QTextDocument *> visited;
+  QList<EmacsModeHandler *> targets;
+  for (const QPointer<EmacsModeHandler> &handler : handlers) {
+    if (handler && !visited.contains(handler->document())) {
+      visited.insert(handler->document());
+      targets.append(handler);
+    }
+  }
+  if (targets.isEmpty()) {
+    report();
+    return;
+  }
+
+  summary->pending = targets.size();
+  showMessage(MessageInfo, EmacsModeHandler::tr("Saving %n file(s)...", 0, targets.size()));
+  for (EmacsModeHandler *handler : targets) {
+    handler->prepareToSave();
+    handler->writeInBackground(handler->currentFileName_, [summary, report](const WriteResult &result) {
+      if (result.error_.isEmpty())
+        ++summary->saved;
+      else
+        summary->errors.append(result.error_);
+      if (!result.backupError_.isEmpty())
+        summary->errors.append(result.backupError_);
+      if (--summary->pending == 0)
+        report();
+    });
+  }
+}
+
+void EmacsModeHandler::copySelectedAction()
+{
+  pluginState.killRing_.push("");
+  pluginState.killRing_.appendTop(tc_.selectedText());
+  anchorCurrentPos();
+  setMoveMode(QTextCursor::MoveAnchor);
+}
+
+void EmacsModeHandler::killSelectedAction()
+{
+  startNewKillBufferEntryIfNecessary();
+  pluginState.killRing_.appendTop(tc_.selectedText());
+  tc_.removeSelectedText();
+  anchorCurrentPos();
+  setMoveMode(QTextCursor::MoveAnchor);
+}
+
+void EmacsModeHandler::killSymbolAction()
+{
+  if (tc_.position() == narrowedEnd()) {
+    showMessage(MessageError, EmacsModeHandler::tr("End of buffer"));
+    return;
+  }
+  startNewKillBufferEntryIfNecessary();
+
+  tc_.setPosition(tc_.position(), QTextCursor::MoveAnchor);
+  tc_.movePosition(QTextCursor::NextCharacter, QTextCursor::KeepAnchor);
+  pluginState.killRing_.appendTop(tc_.selectedText());
+
+  tc_.removeSelectedText();
+}
+
+void EmacsModeHandler::killWordAction()
+{
+  startNewKillBufferEntryIfNecessary();
+
+  const int pos = tc_.position();
+  tc_.setPosition(pos, QTextCursor::MoveAnchor);
+  tc_.setPosition(forwardWordPosition(pos), QTextCursor::KeepAnchor);
+  pluginState.killRing_.appendTop(tc_.selectedText());
+
+  tc_.removeSelectedText();
+}
+
+void EmacsModeHandler::backwardKillWordAction()
+{
+  startNewKillBufferEntryIfNecessary();
+
+  const int pos = tc_.position();
+  tc_.setPosition(pos, QTextCursor::MoveAnchor);
+  tc_.setPosition(backwardWordPosition(pos), QTextCursor::KeepAnchor);
+  pluginState.killRing_.prependTop(tc_.selectedText());
+
+  tc_.removeSelectedText();
+}
+
+// The rectangle with corners at anchor and point, 1 based lines and
+// display columns, endColumn excluded.
+void EmacsModeHandler::rectangleBounds(int *beginLine, int *endLine,
+                                       int *beginColumn, int *endColumn) const
+{
+  const int tabSize = config(ConfigTabStop).toInt();
+  const QTextBlock anchorBlock = document()->findBlock(tc_.anchor());
+  const QTextBlock pointBlock = tc_.block();
+  const int anchorColumn = columnAt(anchorBlock.text(), tc_.anchor() - anchorBlock.position(), tabSize);
+  const int pointColumn = columnAt(pointBlock.text(), tc_.positionInBlock(), tabSize);
+
+  *beginLine = qMin(anchorBlock.blockNumber(), pointBlock.blockNumber()) + 1;
+  *endLine = qMax(anchorBlock.blockNumber(), pointBlock.blockNumber()) + 1;
+  *beginColumn = qMin(anchorColumn, pointColumn);
+  *endColumn = qMax(anchorColumn, pointColumn);
+}
+
+// Puts contents(row) in place of each row of the rectangle, appending
+// the replaced rows to extracted if given. Callers open the edit block.
+void EmacsModeHandler::replaceRectangle(int beginLine, int endLine, int beginColumn, int endColumn,
+                                        const std::function<QString(int)> &contents,
+                                        QString *extracted)
+{
+  const int tabSize = config(ConfigTabStop).toInt();
+  if (extracted)
+    extracted->reserve(extracted->size() + (endLine - beginLine + 1) * (endColumn - beginColumn + 1));
+
+  QTextCursor cursor(document());
+  QTextBlock block = document()->findBlockByNumber(beginLine - 1);
+  for (int line = beginLine; line <= endLine && block.isValid(); ++line, block = block.next()) {
+    const QString text = block.text();
+    if (extracted) {
+      appendRectangleRow(extracted, text, beginColumn, endColumn, tabSize);
+      *extracted += QLatin1Char('\n');
+    }
+
+    const RectangleSpan span = rectangleSpan(text, beginColumn, endColumn, tabSize);
+    const QString replacement = rectangleReplacement(span, text.size(), beginColumn, endColumn,
+                                                     contents(line - beginLine));
+    if (span.begin_ == span.end_ && replacement.isEmpty())
+      continue;
+    cursor.setPosition(block.position() + span.begin_);
+    cursor.setPosition(block.position() + span.end_, QTextCursor::KeepAnchor);
+    cursor.insertText(replacement);
+  }
+}
+
+// Leaves point at the given line and column, without a region.
+void EmacsModeHandler::moveToLineColumn(int line, int column)
+{
+  const QTextBlock block = document()->findBlockByNumber(line - 1);
+  const int index = indexAtColumn(block.text(), column, config(ConfigTabStop).toInt());
+  tc_.setPosition(block.position() + index, QTextCursor::MoveAnchor);
+  setMoveMode(QTextCursor::MoveAnchor);
+}
+
+void EmacsModeHandler::killRectangleAction()
+{
+  int beginLine, endLine, beginColumn, endColumn;
+  rectangleBounds(&beginLine, &endLine, &beginColumn, &endColumn);
+
+  QString killed;
+  beginEditBlock(tc_.position());
+  replaceRectangle(beginLine, endLine, beginColumn, endColumn,
+                   [](int) { return QString(); }, &killed);
+  endEditBlock();
+
+  pluginState.killedRectangle_ = killed;
+  moveToLineColumn(beginLine, beginColumn);
+}
+
+void EmacsModeHandler::yankRectangleAction()
+{
+  QStringList rows = pluginState.killedRectangle_.split(QLatin1Char('\n'));
+  rows.removeLast(); // every row ends in a newline
+  if (rows.isEmpty()) {
+    showMessage(MessageError, EmacsModeHandler::tr("No rectangle to yank"));
+    return;
+  }
+
+  const int tabSize = config(ConfigTabStop).toInt();
+  const QTextBlock block = tc_.block();
+  const int beginLine = block.blockNumber() + 1;
+  const int endLine = beginLine + rows.size() - 1;
+  const int column = columnAt(block.text(), tc_.positionInBlock(), tabSize);
+
+  beginEditBlock(tc_.position());
+  // the rectangle may reach past the end of the document
+  const int missing = endLine - document()->blockCount();
+  if (missing > 0) {
+    QTextCursor cursor(document());
+    cursor.movePosition(QTextCursor::End);
+    cursor.insertText(QString(missing, QLatin1Char('\n')));
+  }
+  replaceRectangle(beginLine, endLine, column, column,
+                   [&rows](int row) { return rows.at(row); }, nullptr);
+  endEditBlock();
+
+  // point ends at the lower right corner
+  const QTextBlock last = document()->findBlockByNumber(endLine - 1);
+  const int index = indexAtColumn(last.text(), column, tabSize) + rows.last().size();
+  tc_.setPosition(last.position() + qMin(index, last.length() - 1), QTextCursor::MoveAnchor);
+  setMoveMode(QTextCursor::MoveAnchor);
+}
+
+void EmacsModeHandler::stringRectangleAction()
+{
+  int beginLine, endLine, beginColumn, endColumn;
+  rectangleBounds(&beginLine, &endLine, &beginColumn, &endColumn);
+
+  readFromMiniBuffer(EmacsModeHandler::tr("String rectangle: "),
+                     [=](const QString &input) {
+    beginEditBlock(tc_.position());
+    replaceRectangle(beginLine, endLine, beginColumn, endColumn,
+                     [&input](int) { return input; }, nullptr);
+    endEditBlock();
+    moveToLineColumn(beginLine, beginColumn);
+  });
+}
+
+void EmacsModeHandler::openRectangleAction()
+{
+  int beginLine, endLine, beginColumn, endColumn;
+  rectangleBounds(&beginLine, &endLine, &beginColumn, &endColumn);
+
+  const QString blank(endColumn - beginColumn, QLatin1Char(' '));
+  beginEditBlock(tc_.position());
+  replaceRectangle(beginLine, endLine, beginColumn, beginColumn,
+                   [&blank](int) { return blank; }, nullptr);
+  endEditBlock();
+  moveToLineColumn(beginLine, beginColumn);
+}
+
+void EmacsModeHandler::clearRectangleAction()
+{
+  int beginLine, endLine, beginColumn, endColumn;
+  rectangleBounds(&beginLine, &endLine, &beginColumn, &endColumn);
+
+  const QString blank(endColumn - beginColumn, QLatin1Char(' '));
+  beginEditBlock(tc_.position());
+  replaceRectangle(beginLine, endLine, beginColumn, endColumn,
+                   [&blank](int) { return blank; }, nullptr);
+  endEditBlock();
+  moveToLineColumn(beginLine, beginColumn);
+}
+
+void EmacsModeHandler::cleanKillRing()
+{
+  pluginState.killRing_.clear();
+}
+
+void EmacsModeHandler::yankCurrentAction()
+{
+  if (!pluginState.killRing_.empty()) {
+    startYankPosition_ = tc_.position();
+    tc_.insertText(pluginState.killRing_.current());
+    endYankPosition_ = tc_.position();
+  }
+}
+
+void EmacsModeHandler::yankNextAction() {
+  if ((lastActionId_ == Action::Id::YankCurrent) || ((lastActionId_ == Action::Id::YankNext) && isValidYankChain_)) {
+    tc_.setPosition(startYankPosition_, QTextCursor::MoveAnchor);
+    tc_.setPosition(endYankPosition_, QTextCursor::KeepAnchor);
+    tc_.removeSelectedText();
+    pluginState.killRing_.advance();
+    isValidYankChain_ = true;
+    yankCurrentAction();
+  } else {
+    showMessage(MessageError, EmacsModeHandler::tr("Previous command wasn't yank!"));
+  }
+}
+
+void EmacsModeHandler::killLineAction()
+{
+  startNewKillBufferEntryIfNecessary();
+  bool isEndOfLine = (atEndOfLine() || (tc_.block().length() == 1));
+
+  // Kill to the end of the logical line. Positions come from the block
+  // alone, QTextCursor::movePosition would lay out the whole line first.
+  const QTextBlock block = tc_.block();
+  const int pos = tc_.position();
+  const int end = isEndOfLine ? qMin(pos + 1, narrowedEnd())
+                              : block.position() + block.length() - 1;
+  tc_.setPosition(pos, QTextCursor::MoveAnchor);
+  tc_.setPosition(end, QTextCursor::KeepAnchor);
+  pluginState.killRing_.appendTop(tc_.selectedText());
+  tc_.removeSelectedText();
+}
+
+void EmacsModeHandler::setMoveMode(QTextCursor::MoveMode moveMode)
+{
+  moveMode_ = moveMode;
+}
+
+void EmacsModeHandler::startSelectionAction() {
+  anchorCurrentPos();
+  setMoveMode(QTextCursor::KeepAnchor);
+}
+
+void EmacsModeHandler::cancelCurrentCommandAction() {
+  setMoveMode(QTextCursor::MoveAnchor);
+  anchorCurrentPos();
+  lastActionId_ = Action::Id::Null;
+}
+
+void EmacsModeHandler::keyboardQuitAction() {
+  cancelCurrentCommandAction();
+  recordingMacro_ = false;
+  broadcastNext_ = false;
+  if (shellCommand_)
+    shellCommand_->cancel();
+  // also stops long running work, like region indentation
+  emit quitRequested();
+  showMessage(MessageInfo, EmacsModeHandler::tr("Quit"));
+}
+
+void EmacsModeHandler::dabbrevExpandAction()
+{
+  expandAbbreviation(Action::Id::DabbrevExpand, [this](const QString &prefix, int pos) {
+    flushIndexUpdates();
+    // this buffer backward and forward from point, then the other buffers
+    QStringList candidates = wordIndex_.completions(prefix, pos);
+    QStringList others;
+    emit wordCompletionsRequested(prefix, &others);
+    return candidates + others;
+  });
+}
+
+void EmacsModeHandler::hippieExpandAction()
+{
+  expandAbbreviation(Action::Id::HippieExpand, [this](const QString &prefix, int) {
+    syncKillRingSymbols();
+    emit symbolDictionaryRequested();
+    return pluginState.symbols_.completions(prefix);
+  });
+}
+
+void EmacsModeHandler::expandAbbreviation(Action::Id id,
+                                          std::function<QStringList(const QString &, int)> candidates)
+{
+  const int pos = tc_.position();
+
+  if (lastActionId_ != id || pos != expansionEnd_) {
+    // the expansion left in place last time was accepted
+    if (!acceptedExpansion_.isEmpty())
+      pluginState.symbols_.touch(acceptedExpansion_);
+    acceptedExpansion_.clear();
+
+    const QTextBlock block = tc_.block();
+    const QString text = block.text();
+    const int column = pos - block.position();
+    const int start = skipBackward(text.constData(), column, WordChars);
+    if (start == column) {
+      showMessage(MessageError, EmacsModeHandler::tr("No dynamic expansion for the empty prefix"));
+      return;
+    }
+
+    expansionPrefix_ = text.mid(start, column - start);
+    expansionStart_ = block.position() + start;
+    expansionEnd_ = pos;
+    expansionNext_ = 0;
+    expansionCandidates_.clear();
+
+    QSet<QString> seen;
+    seen.insert(expansionPrefix_);
+    foreach (const QString &word, candidates(expansionPrefix_, pos)) {
+      if (!seen.contains(word)) {
+        seen.insert(word);
+        expansionCandidates_.append(word);
+      }
+    }
+
+    if (expansionCandidates_.isEmpty()) {
+      showMessage(MessageError, EmacsModeHandler::tr("No dynamic expansion for '%1' found")
+                  .arg(expansionPrefix_));
+      return;
+    }
+  }
+
+  QString expansion = expansionPrefix_;
+  if (expansionNext_ < expansionCandidates_.size()) {
+    expansion = expansionCandidates_.at(expansionNext_++);
+    acceptedExpansion_ = expansion;
+  } else {
+    // restore the abbreviation, the next press starts over
+    expansionNext_ = 0;
+    acceptedExpansion_.clear();
+    showMessage(MessageError, EmacsModeHandler::tr("No further dynamic expansion for '%1' found")
+                .arg(expansionPrefix_));
+  }
+
+  tc_.setPosition(expansionStart_, QTextCursor::MoveAnchor);
+  tc_.setPosition(expansionEnd_, QTextCursor::KeepAnchor);
+  tc_.insertText(expansion);
+  expansionEnd_ = tc_.position();
+}
+
+void EmacsModeHandler::syncKillRingSymbols()
+{
+  const KillRing &killRing = pluginState.killRing_;
+  if (pluginState.killRingSymbolsRevision_ == killRing.revision())
+    return;
+
+  QStringList words;
+  foreach (const QString &entry, killRing.entries())
+    words += wordsOf(entry);
+  pluginState.symbols_.setSourceWords(SymbolDictionary::KillRingSource, words);
+  pluginState.killRingSymbolsRevision_ = killRing.revision();
+}
+
+void EmacsModeHandler::anchorCurrentPos()
+{
+  tc_.setPosition(tc_.position(), QTextCursor::MoveAnchor);
+}
+
+bool EmacsModeHandler::wantsOverride(QKeyEvent *ev)
+{
+  if (isPrompting())
+    return true;
+
+  TShortcutList shortcuts = partialShortcuts_.empty() ? shortcuts_ : partialShortcuts_;
+  for (TShortcutList::const_iterator it = shortcuts.begin(); it != shortcuts.end(); ++it)
+    if (it->isAccepted(ev))
+      return true;
+  return false;
+}
+
+EventResult EmacsModeHandler::handleEvent(QKeyEvent *ev)
+{
+  tc_ = EDITOR(textCursor());
+
+  if (isPrompting()) {
+    EventResult result = handlePromptEvent(ev);
+    keepCursorInNarrowing();
+    EDITOR(setTextCursor(tc_));
+    return result;
+  }
+
+  // keys handled by the editor must not join a hidden line either
+  if (narrowed_ && !tc_.hasSelection()
+      && ((ev->key() == Qt::Key_Delete && tc_.position() == narrowedEnd())
+          || (ev->key() == Qt::Key_Backspace && tc_.position() == narrowedBegin()))) {
+    showMessage(MessageError, ev->key() == Qt::Key_Delete
+                ? EmacsModeHandler::tr("End of buffer")
+                : EmacsModeHandler::tr("Beginning of buffer"));
+    return EventHandled;
+  }
+
+  if (partialShortcuts_.empty()) {
+    const int key = ev->key();
+    if (hasConfig(ConfigAutoFill) && !(ev->modifiers() & (Qt::ControlModifier | Qt::AltModifier | Qt::MetaModifier))
+        && (key == Qt::Key_Space || key == Qt::Key_Return || key == Qt::Key_Enter))
+      autoFill();
+    partialShortcuts_ = shortcuts_;
+  }
+
+  TShortcutList newPartialShortcuts;
+  bool executed = false;
+  bool isAccepted = false;
+
+  for (TShortcutList::const_iterator it = partialShortcuts_.begin(); it != partialShortcuts_.end(); ++it)
+  {
+    if (it->isAccepted(ev))
+    {
+      isAccepted = true;
+      if (it->hasFollower(ev))
+        newPartialShortcuts.push_back(it->getFollower(ev));
+      else
+      {
+        if (broadcastNext_ && !isPrefixArgument(it->actionId()) && !isMacroCommand(it->actionId())) {
+          broadcastNext_ = false;
+          applyToRegionLines(Macro(1, MacroStep{it->action(), QStringList()}));
+        } else {
+          it->exec();
+        }
+        lastActionId_ = it->actionId();
+        if (recordingMacro_ && !isMacroCommand(lastActionId_))
+          recordedMacro_.push_back(MacroStep{it->action(), QStringList()});
+        if (!isPrefixArgument(lastActionId_))
+          clearPrefixArgument();
+        executed = true;
+        partialShortcuts_.clear();
+        break;
+      }
+    }
+  }
+
+  if (!executed)
+    partialShortcuts_ = newPartialShortcuts;
+
+  // keys the editor handles itself: typing, Return, Delete
+  MacroStep step;
+  if (!isAccepted && (recordingMacro_ || broadcastNext_) && recordCoreKey(ev, &step)) {
+    if (recordingMacro_)
+      recordedMacro_.push_back(step);
+    if (broadcastNext_) {
+      broadcastNext_ = false;
+      applyToRegionLines(Macro(1, step));
+      isAccepted = true;
+    }
+  }
+
+  keepCursorInNarrowing();
+  EDITOR(setTextCursor(tc_));
+
+  return isAccepted ? EventHandled : EventPassedToCore;
+}
+
+bool EmacsModeHandler::isPrompting() const
+{
+  return bool(promptAccept_);
+}
+
+void EmacsModeHandler::readFromMiniBuffer(const QString &prompt,
+                                          std::function<void(const QString &)> accept)
+{
+  // a replayed macro answers with what was typed while recording it,
+  // a prompt that was cancelled then is skipped
+  if (replayingMacro_) {
+    if (!replayAnswers_.isEmpty())
+      accept(replayAnswers_.takeFirst());
+    return;
+  }
+  promptLabel_ = prompt;
+  promptText_.clear();
+  promptAccept_ = std::move(accept);
+  promptReadsChar_ = false;
+  promptCompletesFileNames_ = false;
+  showMessage(MessageShowCmd, promptLabel_);
+}
+
+void EmacsModeHandler::readCharFromMiniBuffer(const QString &prompt,
+                                              std::function<void(const QString &)> accept)
+{
+  readFromMiniBuffer(prompt, std::move(accept));
+  promptReadsChar_ = true;
+}
+
+EventResult EmacsModeHandler::handlePromptEvent(QKeyEvent *ev)
+{
+  static const Shortcut quit("<META>|g", Action());
+
+  const int key = ev->key();
+  if (promptReadsChar_ && key != Qt::Key_Escape && !quit.isAccepted(ev)) {
+    const QString text = (key == Qt::Key_Return || key == Qt::Key_Enter)
+        ? QString(QLatin1Char('\n')) : ev->text();
+    // ignore lone modifiers and other keys without text
+    if (text.isEmpty() || !(text.at(0).isPrint() || text.at(0) == QLatin1Char('\n')))
+      return EventHandled;
+    std::function<void(const QString &)> accept;
+    accept.swap(promptAccept_);
+    showMessage(MessageInfo, QString());
+    if (recordingMacro_ && !recordedMacro_.empty())
+      recordedMacro_.back().answers_.append(text.left(1));
+    accept(text.left(1));
+  } else if (key == Qt::Key_Return || key == Qt::Key_Enter) {
+    // the callback may start another prompt
+    std::function<void(const QString &)> accept;
+    accept.swap(promptAccept_);
+    showMessage(MessageInfo, QString());
+    if (recordingMacro_ && !recordedMacro_.empty())
+      recordedMacro_.back().answers_.append(promptText_);
+    accept(promptText_);
+  } else if (key == Qt::Key_Escape || quit.isAccepted(ev)) {
+    promptAccept_ = nullptr;
+    showMessage(MessageInfo, EmacsModeHandler::tr("Quit"));
+  } else if (key == Qt::Key_Backspace) {
+    promptText_.chop(1);
+    showPrompt();
+  } else if (key == Qt::Key_Tab && promptCompletesFileNames_) {
+    completeFileName();
+  } else if (!ev->text().isEmpty() && ev->text().at(0).isPrint()) {
+    promptText_ += ev->text();
+    showPrompt();
+  }
+  return EventHandled;
+}
+
+void EmacsModeHandler::showPrompt()
+{
+  QString text = promptLabel_ + promptText_;
+  if (promptCompletesFileNames_) {
+    bool pending = false;
+    const QStringList completions = fileNameCompletions(promptText_, MaxShownCompletions + 1, &pending);
+    const int directoryLength = promptText_.lastIndexOf(QLatin1Char('/')) + 1;
+    if (pending) {
+      text += QLatin1String(" [...]");
+    } else if (completions.isEmpty()) {
+      text += EmacsModeHandler::tr(" [No match]");
+    } else {
+      QStringList names;
+      for (int i = 0; i < completions.size() && i < MaxShownCompletions; ++i)
+        names.append(completions.at(i).mid(directoryLength));
+      if (completions.size() > MaxShownCompletions)
+        names.append(QLatin1String("..."));
+      text += QLatin1String(" {") + names.join(QLatin1String(" | ")) + QLatin1Char('}');
+    }
+  }
+  showMessage(MessageShowCmd, text);
+}
+
+// Opens a file in a new editor. The prompt starts in the directory of
+// the current file.
+void EmacsModeHandler::findFileAction()
+{
+  connect(DirectoryCache::instance(), SIGNAL(listed(QString)),
+          this, SLOT(onDirectoryListed()), Qt::UniqueConnection);
+
+  const int slash = currentFileName_.lastIndexOf(QLatin1Char('/'));
+  const QString directory = slash < 0 ? QDir::homePath() : currentFileName_.left(slash);
+  readFromMiniBuffer(EmacsModeHandler::tr("Find file: "), [this](const QString &input) {
+    QString fileName = input;
+    if (fileName.startsWith(QLatin1Char('~')))
+      fileName = QDir::homePath() + fileName.mid(1);
+    if (fileName.isEmpty() || fileName.endsWith(QLatin1Char('/'))) {
+      showMessage(MessageError, EmacsModeHandler::tr("No file name given"));
+      return;
+    }
+    emit openFileRequested(QDir::cleanPath(fileName));
+  });
+  if (!promptAccept_) // answered by a replayed macro
+    return;
+  promptCompletesFileNames_ = true;
+  promptText_ = directory + QLatin1Char('/');
+  showPrompt();
+}
+
+// The names in the directory part of text that match the rest of it,
+// each as the whole text it would complete to. Nothing is read here: a
+// directory that is not cached yet sets pending and is listed later.
+QStringList EmacsModeHandler::fileNameCompletions(const QString &text, int limit, bool *pending) const
+{
+  const int slash = text.lastIndexOf(QLatin1Char('/'));
+  if (slash < 0)
+    return QStringList();
+  const QString directoryPart = text.left(slash + 1);
+  QString directory = directoryPart;
+  if (directory.startsWith(QLatin1Char('~')))
+    directory = QDir::homePath() + directory.mid(1);
+
+  DirectoryListing listing;
+  if (!DirectoryCache::instance()->listing(QDir::cleanPath(directory), &listing)) {
+    *pending = true;
+    return QStringList();
+  }
+  QStringList completions = fuzzyMatches(listing, text.mid(slash + 1), limit);
+  for (QString &completion : completions)
+    completion.prepend(directoryPart);
+  return completions;
+}
+
+// Tab: a single match replaces the text, several extend it by what
+// they have in common.
+void EmacsModeHandler::completeFileName()
+{
+  bool pending = false;
+  const QStringList completions = fileNameCompletions(promptText_, -1, &pending);
+  if (!completions.isEmpty()) {
+    QString common = completions.first();
+    for (const QString &completion : completions) {
+      int length = 0;
+      while (length < common.size() && length < completion.size()
+             && common.at(length) == completion.at(length))
+        ++length;
+      common.truncate(length);
+    }
+    if (common.size() > promptText_.size())
+      promptText_ = common;
+  }
+  showPrompt();
+}
+
+void EmacsModeHandler::onDirectoryListed()
+{
+  if (promptAccept_ && promptCompletesFileNames_)
+    showPrompt();
+}
+
+void EmacsModeHandler::installEventFilter()
+{
+  EDITOR(installEventFilter(this));
+}
+
+void EmacsModeHandler::setUndoPosition(int pos)
+{
+  undoCursorPosition_[tc_.document()->availableUndoSteps()] = pos;
+}
+
+void EmacsModeHandler::moveToEndOfLineAction()
+{
+  const QTextBlock block = tc_.block();
+  if (logicalLines())
+    tc_.setPosition(block.position() + block.length() - 1, moveMode_);
+  else // does not work for "hidden" documents like in the autotests
+    tc_.movePosition(QTextCursor::EndOfLine, moveMode_);
+}
+
+void EmacsModeHandler::moveToStartOfLineAction()
+{
+  if (logicalLines())
+    tc_.setPosition(tc_.block().position(), moveMode_);
+  else // does not work for "hidden" documents like in the autotests
+    tc_.movePosition(QTextCursor::StartOfLine, moveMode_);
+}
+
+void EmacsModeHandler::updateMiniBuffer()
+{
+  if (!textedit_ && !plaintextedit_)
+    return;
+
+  QString msg;
   MessageLevel messageLevel = MessageInfo;
 
   if (!pluginState.currentMessage_.isEmpty()) {
@@ -659,11 +2280,35 @@ void EmacsModeHandler::showMessage(MessageLevel level, const QString &msg)
 }
 
 void EmacsModeHandler::moveUpAction(int n) {
-  tc_.movePosition(QTextCursor::Up, moveMode_, n);
+  if (logicalLines())
+    moveByLogicalLines(-n);
+  else
+    tc_.movePosition(QTextCursor::Up, moveMode_, n);
 }
 
 void EmacsModeHandler::moveDownAction(int n) {
-  tc_.movePosition(QTextCursor::Down, moveMode_, n);
+  if (logicalLines())
+    moveByLogicalLines(n);
+  else
+    tc_.movePosition(QTextCursor::Down, moveMode_, n);
+}
+
+// Moves between blocks without consulting the layout, keeping the column
+// of the first motion in a row as the goal. Cursor moves done outside
+// the handler (arrow keys, mouse) start a new row.
+void EmacsModeHandler::moveByLogicalLines(int n) {
+  if ((lastActionId_ != Action::Id::MoveUp && lastActionId_ != Action::Id::MoveDown)
+      || tc_.position() != goalPosition_)
+    goalColumn_ = tc_.positionInBlock();
+
+  QTextBlock block = tc_.block();
+  for (; n > 0 && block.next().isValid(); --n)
+    block = block.next();
+  for (; n < 0 && block.previous().isValid(); ++n)
+    block = block.previous();
+
+  tc_.setPosition(block.position() + qMin(goalColumn_, block.length() - 1), moveMode_);
+  goalPosition_ = tc_.position();
 }
 
 void EmacsModeHandler::moveRightAction(int n) {
@@ -674,11 +2319,390 @@ void EmacsModeHandler::moveLeftAction(int n) {
   tc_.movePosition(QTextCursor::Left, moveMode_, n);
 }
 
+void EmacsModeHandler::forwardWordAction() {
+  tc_.setPosition(forwardWordPosition(tc_.position()), moveMode_);
+}
+
+void EmacsModeHandler::backwardWordAction() {
+  tc_.setPosition(backwardWordPosition(tc_.position()), moveMode_);
+}
+
+void EmacsModeHandler::forwardParagraphAction() {
+  tc_.setPosition(forwardParagraphPosition(tc_.position()), moveMode_);
+}
+
+void EmacsModeHandler::backwardParagraphAction() {
+  tc_.setPosition(backwardParagraphPosition(tc_.position()), moveMode_);
+}
+
+void EmacsModeHandler::markParagraphAction()
+{
+  const int end = forwardParagraphPosition(tc_.position());
+  tc_.setPosition(end, QTextCursor::MoveAnchor);
+  tc_.setPosition(backwardParagraphPosition(end), QTextCursor::KeepAnchor);
+  setMoveMode(QTextCursor::KeepAnchor);
+}
+
+void EmacsModeHandler::killParagraphAction()
+{
+  startNewKillBufferEntryIfNecessary();
+
+  const int pos = tc_.position();
+  tc_.setPosition(pos, QTextCursor::MoveAnchor);
+  tc_.setPosition(forwardParagraphPosition(pos), QTextCursor::KeepAnchor);
+  pluginState.killRing_.appendTop(tc_.selectedText());
+
+  tc_.removeSelectedText();
+}
+
+// Start of the first blank line after the paragraph at or after pos.
+int EmacsModeHandler::forwardParagraphPosition(int pos)
+{
+  flushIndexUpdates();
+  const int block = document()->findBlock(pos).blockNumber();
+  const int start = blankLines_.findForward(block, false);
+  const int end = start == -1 ? -1 : blankLines_.findForward(start, true);
+  return end == -1 ? narrowedEnd()
+                   : clampToNarrowing(document()->findBlockByNumber(end).position());
+}
+
+// Start of the last blank line before the paragraph at or before pos.
+int EmacsModeHandler::backwardParagraphPosition(int pos)
+{
+  flushIndexUpdates();
+  const QTextBlock current = document()->findBlock(pos);
+  // from the first column the paragraph starting here is already behind
+  const int block = pos == current.position() ? current.blockNumber() - 1 : current.blockNumber();
+  const int start = blankLines_.findBackward(block, false);
+  const int end = start == -1 ? -1 : blankLines_.findBackward(start, true);
+  return end == -1 ? narrowedBegin()
+                   : clampToNarrowing(document()->findBlockByNumber(end).position());
+}
+
+void EmacsModeHandler::forwardSexpAction()
+{
+  const int pos = forwardSexpPosition(tc_.position());
+  if (pos != -1)
+    tc_.setPosition(pos, moveMode_);
+}
+
+void EmacsModeHandler::backwardSexpAction()
+{
+  const int pos = backwardSexpPosition(tc_.position());
+  if (pos != -1)
+    tc_.setPosition(pos, moveMode_);
+}
+
+void EmacsModeHandler::backwardUpListAction()
+{
+  flushIndexUpdates();
+  const int pos = brackets_.enclosingOpenBracket(tc_.position());
+  if (pos == -1)
+    showMessage(MessageError, EmacsModeHandler::tr("At top level"));
+  else
+    tc_.setPosition(pos, moveMode_);
+}
+
+void EmacsModeHandler::killSexpAction()
+{
+  const int pos = tc_.position();
+  const int end = forwardSexpPosition(pos);
+  if (end == -1)
+    return;
+
+  startNewKillBufferEntryIfNecessary();
+  tc_.setPosition(pos, QTextCursor::MoveAnchor);
+  tc_.setPosition(end, QTextCursor::KeepAnchor);
+  pluginState.killRing_.appendTop(tc_.selectedText());
+
+  tc_.removeSelectedText();
+}
+
+bool EmacsModeHandler::isPrefixArgument(Action::Id id) const
+{
+  return id == Action::Id::DigitArgument || id == Action::Id::NegativeArgument
+      || id == Action::Id::UniversalArgument;
+}
+
+void EmacsModeHandler::clearPrefixArgument()
+{
+  hasPrefixArg_ = false;
+  prefixDigits_ = false;
+  prefixArg_ = 1;
+  prefixSign_ = 1;
+}
+
+int EmacsModeHandler::repeatCount() const
+{
+  return hasPrefixArg_ ? prefixSign_ * prefixArg_ : 1;
+}
+
+void EmacsModeHandler::digitArgumentAction(int digit)
+{
+  prefixArg_ = prefixDigits_ ? qMin(prefixArg_ * 10 + digit, MaxRepeatCount) : digit;
+  prefixDigits_ = true;
+  hasPrefixArg_ = true;
+  showMessage(MessageShowCmd, QString::fromLatin1("C-u %1-").arg(repeatCount()));
+}
+
+void EmacsModeHandler::negativeArgumentAction()
+{
+  prefixSign_ = -prefixSign_;
+  hasPrefixArg_ = true;
+  showMessage(MessageShowCmd, QString::fromLatin1("C-u %1-").arg(repeatCount()));
+}
+
+void EmacsModeHandler::universalArgumentAction()
+{
+  // each C-u multiplies by four until digits are typed
+  if (!prefixDigits_)
+    prefixArg_ = qMin(prefixArg_ * 4, MaxRepeatCount);
+  hasPrefixArg_ = true;
+  showMessage(MessageShowCmd, QString::fromLatin1("C-u %1-").arg(repeatCount()));
+}
+
+// Position of the count-th c at or after pos for a positive count, or
+// before pos for a negative one, -1 if there are fewer. A newline
+// matches the end of every block but the last. Only the accessible part
+// of a narrowed buffer is searched.
+int EmacsModeHandler::findCharPosition(int pos, QChar c, int count) const
+{
+  const bool newline = c == QLatin1Char('\n');
+  const QTextBlock first = document()->findBlock(pos);
+  const int begin = narrowedBegin();
+  const int end = narrowedEnd();
+
+  if (count > 0) {
+    for (QTextBlock block = first; block.isValid() && block.position() <= end; block = block.next()) {
+      const QString text = block.text();
+      int column = pos - block.position();
+      while ((column = findForward(text.constData(), text.size(), column, c)) != -1) {
+        if (--count == 0)
+          return block.position() + column;
+        ++column;
+      }
+      if (newline && block.position() + text.size() < end && --count == 0)
+        return block.position() + text.size();
+    }
+  } else if (count < 0) {
+    for (QTextBlock block = first; block.isValid() && block.position() >= begin; block = block.previous()) {
+      const QString text = block.text();
+      if (newline && block != first && ++count == 0)
+        return block.position() + text.size();
+      int column = qMin(pos - block.position(), text.size());
+      while ((column = findBackward(text.constData(), column, c)) != -1) {
+        if (++count == 0)
+          return block.position() + column;
+      }
+    }
+  }
+  return -1;
+}
+
+void EmacsModeHandler::zapToCharAction(bool inclusive)
+{
+  const int count = repeatCount();
+  // the prompt is answered by later key presses, keep what came before
+  const Action::Id previousActionId = lastActionId_;
+  const QString prompt = inclusive ? EmacsModeHandler::tr("Zap to char: ")
+                                   : EmacsModeHandler::tr("Zap up to char: ");
+
+  readCharFromMiniBuffer(prompt, [this, count, inclusive, previousActionId](const QString &input) {
+    if (count == 0)
+      return;
+    const QChar c = input.at(0);
+    const int pos = tc_.position();
+    const int direction = count > 0 ? 1 : -1;
+    // zap-up-to-char never stops at the character next to point
+    const int from = inclusive ? pos : clampToNarrowing(pos + direction);
+    const int target = findCharPosition(from, c, count);
+    if (target == -1) {
+      showMessage(MessageError, EmacsModeHandler::tr("Search failed: \"%1\"").arg(input));
+      return;
+    }
+
+    const int end = (count > 0) == inclusive ? target + 1 : target;
+    startNewKillBufferEntryIfNecessary(previousActionId);
+    tc_.setPosition(pos, QTextCursor::MoveAnchor);
+    tc_.setPosition(end, QTextCursor::KeepAnchor);
+    if (count > 0)
+      pluginState.killRing_.appendTop(tc_.selectedText());
+    else
+      pluginState.killRing_.prependTop(tc_.selectedText());
+    tc_.removeSelectedText();
+  });
+}
+
+void EmacsModeHandler::jumpToCharAction()
+{
+  const int count = repeatCount();
+  readCharFromMiniBuffer(EmacsModeHandler::tr("Jump to char: "), [this, count](const QString &input) {
+    if (count == 0)
+      return;
+    // skip the character under point so that repeated jumps advance
+    const int pos = tc_.position();
+    const int target = findCharPosition(count > 0 ? pos + 1 : pos, input.at(0), count);
+    if (target == -1)
+      showMessage(MessageError, EmacsModeHandler::tr("Search failed: \"%1\"").arg(input));
+    else
+      tc_.setPosition(target, moveMode_);
+  });
+}
+
+static bool isOpenBracket(QChar c)
+{
+  return c == QLatin1Char('(') || c == QLatin1Char('[') || c == QLatin1Char('{');
+}
+
+static bool isCloseBracket(QChar c)
+{
+  return c == QLatin1Char(')') || c == QLatin1Char(']') || c == QLatin1Char('}');
+}
+
+// A symbol, a string or a bracket starts a balanced expression, white
+// space and other punctuation are skipped. Only bracket characters are
+// looked up in the index, by the number of the block being scanned.
+bool EmacsModeHandler::startsSexp(const QString &text, int column, int blockNumber)
+{
+  const QChar c = text.at(column);
+  if (isWordChar(c) || c == QLatin1Char('"'))
+    return true;
+  return (isOpenBracket(c) || isCloseBracket(c)) && brackets_.isBracketAt(blockNumber, column);
+}
+
+int EmacsModeHandler::forwardSexpPosition(int pos)
+{
+  flushIndexUpdates();
+  for (QTextBlock block = document()->findBlock(pos); block.isValid(); block = block.next()) {
+    const QString &text = blockText(block);
+    const int blockNumber = block.blockNumber();
+    int column = qMax(0, pos - block.position());
+    for (;;) {
+      column = skipForward(text.constData(), text.size(), column, BlankChars);
+      if (column == text.size() || startsSexp(text, column, blockNumber))
+        break;
+      ++column;
+    }
+    if (column == text.size())
+      continue;
+
+    const int start = block.position() + column;
+    const QChar c = text.at(column);
+    if (isWordChar(c))
+      return block.position() + skipForward(text.constData(), text.size(), column, WordChars);
+
+    if (c == QLatin1Char('"')) {
+      int end = column + 1;
+      while (end < text.size() && text.at(end) != QLatin1Char('"'))
+        end += text.at(end) == QLatin1Char('\\') ? 2 : 1;
+      return block.position() + qMin(end + 1, text.size());
+    }
+
+    if (isCloseBracket(c)) {
+      showMessage(MessageError, EmacsModeHandler::tr("Containing expression ends prematurely"));
+      return -1;
+    }
+    const int match = brackets_.matchingBracket(start);
+    if (match == -1) {
+      showMessage(MessageError, EmacsModeHandler::tr("Unbalanced parentheses"));
+      return -1;
+    }
+    return clampToNarrowing(match + 1);
+  }
+  return narrowedEnd();
+}
+
+int EmacsModeHandler::backwardSexpPosition(int pos)
+{
+  flushIndexUpdates();
+  for (QTextBlock block = document()->findBlock(pos); block.isValid(); block = block.previous()) {
+    const QString &text = blockText(block);
+    const int blockNumber = block.blockNumber();
+    int column = qMin(pos - block.position(), text.size());
+    for (;;) {
+      column = skipBackward(text.constData(), column, BlankChars);
+      if (column == 0 || startsSexp(text, column - 1, blockNumber))
+        break;
+      --column;
+    }
+    if (column == 0)
+      continue;
+
+    // column is just after the last character of the expression
+    const int last = block.position() + column - 1;
+    const QChar c = text.at(column - 1);
+    if (isWordChar(c))
+      return block.position() + skipBackward(text.constData(), column, WordChars);
+
+    if (c == QLatin1Char('"')) {
+      int begin = column - 2;
+      while (begin > 0 && !(text.at(begin) == QLatin1Char('"') && text.at(begin - 1) != QLatin1Char('\\')))
+        --begin;
+      return block.position() + qMax(begin, 0);
+    }
+
+    if (!isCloseBracket(c)) {
+      showMessage(MessageError, EmacsModeHandler::tr("Containing expression ends prematurely"));
+      return -1;
+    }
+    const int match = brackets_.matchingBracket(last);
+    if (match == -1) {
+      showMessage(MessageError, EmacsModeHandler::tr("Unbalanced parentheses"));
+      return -1;
+    }
+    return clampToNarrowing(match);
+  }
+  return narrowedBegin();
+}
+
+const QString &EmacsModeHandler::blockText(const QTextBlock &block) const
+{
+  // an invalid block's number is -1, the same as an invalidated cache
+  if (!block.isValid()) {
+    static const QString empty;
+    return empty;
+  }
+  if (block.blockNumber() != cachedBlockNumber_) {
+    cachedBlockText_ = block.text();
+    cachedBlockNumber_ = block.blockNumber();
+  }
+  return cachedBlockText_;
+}
+
+int EmacsModeHandler::forwardWordPosition(int pos) const
+{
+  // a block boundary always separates words
+  for (QTextBlock block = document()->findBlock(pos); block.isValid(); block = block.next()) {
+    const QString &text = blockText(block);
+    const int from = qMax(0, pos - block.position());
+    const int start = skipForward(text.constData(), text.size(), from, NonWordChars);
+    if (start < text.size())
+      return clampToNarrowing(block.position() + skipForward(text.constData(), text.size(), start, WordChars));
+  }
+  return narrowedEnd();
+}
+
+int EmacsModeHandler::backwardWordPosition(int pos) const
+{
+  for (QTextBlock block = document()->findBlock(pos); block.isValid(); block = block.previous()) {
+    const QString &text = blockText(block);
+    const int from = qMin(pos - block.position(), text.size());
+    const int end = skipBackward(text.constData(), from, NonWordChars);
+    if (end > 0)
+      return clampToNarrowing(block.position() + skipBackward(text.constData(), end, WordChars));
+  }
+  return narrowedBegin();
+}
+
 void EmacsModeHandler::newLineAction() {
   tc_.insertBlock();
 }
 
 void EmacsModeHandler::backspaceAction() {
+  if (!tc_.hasSelection() && tc_.position() == narrowedBegin()) {
+    showMessage(MessageError, EmacsModeHandler::tr("Beginning of buffer"));
+    return;
+  }
   tc_.deletePreviousChar();
 }
 
@@ -690,6 +2714,127 @@ void EmacsModeHandler::insertStraightDelimAction() {
   tc_.insertText(QString::fromLatin1("|"));
 }
 
+// Lines of the previous screen that stay visible after paging.
+static const int NextScreenContextLines = 2;
+
+// Pages through the scroll bar, which counts visual lines in a
+// QPlainTextEdit and pixels in a QTextEdit, so only the blocks that end
+// up on screen get laid out. Point only moves if it left the screen.
+void EmacsModeHandler::scrollUpAction()
+{
+  QScrollBar *scrollBar = EDITOR(verticalScrollBar());
+  if (scrollBar->value() == scrollBar->maximum()) {
+    tc_.setPosition(narrowedEnd(), moveMode_);
+    showMessage(MessageError, EmacsModeHandler::tr("End of buffer"));
+    return;
+  }
+
+  scrollBar->setValue(scrollBar->value() + scrollBar->pageStep() - contextLines());
+  if (!isCursorVisible())
+    tc_.setPosition(EDITOR(cursorForPosition(QPoint(0, 0))).position(), moveMode_);
+}
+
+void EmacsModeHandler::scrollDownAction()
+{
+  QScrollBar *scrollBar = EDITOR(verticalScrollBar());
+  if (scrollBar->value() == scrollBar->minimum()) {
+    tc_.setPosition(narrowedBegin(), moveMode_);
+    showMessage(MessageError, EmacsModeHandler::tr("Beginning of buffer"));
+    return;
+  }
+
+  scrollBar->setValue(scrollBar->value() - scrollBar->pageStep() + contextLines());
+  if (!isCursorVisible()) {
+    const int bottom = EDITOR(viewport())->height() - EDITOR(cursorRect(tc_)).height();
+    tc_.setPosition(EDITOR(cursorForPosition(QPoint(0, bottom))).position(), moveMode_);
+  }
+}
+
+void EmacsModeHandler::recenterTopBottomAction()
+{
+  if (lastActionId_ != Action::Id::RecenterTopBottom)
+    recenterState_ = 0;
+
+  const int lineHeight = EDITOR(cursorRect(tc_)).height();
+  const int viewportHeight = EDITOR(viewport())->height();
+  switch (recenterState_) {
+  case 0:
+    scrollCursorTo((viewportHeight - lineHeight) / 2);
+    break;
+  case 1:
+    scrollCursorTo(0);
+    break;
+  default:
+    scrollCursorTo(viewportHeight - lineHeight);
+    break;
+  }
+  recenterState_ = (recenterState_ + 1) % 3;
+}
+
+int EmacsModeHandler::contextLines() const
+{
+  // QTextEdit scrolls by pixels
+  return plaintextedit_ ? NextScreenContextLines
+                        : NextScreenContextLines * EDITOR(fontMetrics()).lineSpacing();
+}
+
+bool EmacsModeHandler::isCursorVisible() const
+{
+  return EDITOR(viewport())->rect().contains(EDITOR(cursorRect(tc_)));
+}
+
+// Scrolls so that the cursor line starts at viewport coordinate y.
+void EmacsModeHandler::scrollCursorTo(int y)
+{
+  QScrollBar *scrollBar = EDITOR(verticalScrollBar());
+  const QRect rect = EDITOR(cursorRect(tc_));
+  const int delta = rect.top() - y;
+  scrollBar->setValue(scrollBar->value() + (plaintextedit_ ? delta / qMax(1, rect.height()) : delta));
+}
+
+void EmacsModeHandler::gotoLineAction()
+{
+  readFromMiniBuffer(EmacsModeHandler::tr("Goto line: "), [this](const QString &input) {
+    bool ok = false;
+    const int line = input.trimmed().toInt(&ok);
+    if (!ok) {
+      showMessage(MessageError, EmacsModeHandler::tr("Invalid line number: %1").arg(input));
+      return;
+    }
+    tc_.setPosition(firstPositionInLine(qBound(1, line, linesInDocument())), moveMode_);
+  });
+}
+
+void EmacsModeHandler::gotoCharAction()
+{
+  readFromMiniBuffer(EmacsModeHandler::tr("Goto char: "), [this](const QString &input) {
+    bool ok = false;
+    const int pos = input.trimmed().toInt(&ok);
+    if (!ok) {
+      showMessage(MessageError, EmacsModeHandler::tr("Invalid position: %1").arg(input));
+      return;
+    }
+    // Emacs counts characters from 1
+    tc_.setPosition(qBound(0, pos - 1, lastPositionInDocument()), moveMode_);
+  });
+}
+
+void EmacsModeHandler::moveToColumnAction()
+{
+  readFromMiniBuffer(EmacsModeHandler::tr("Move to column: "), [this](const QString &input) {
+    bool ok = false;
+    const int column = input.trimmed().toInt(&ok);
+    if (!ok) {
+      showMessage(MessageError, EmacsModeHandler::tr("Invalid column: %1").arg(input));
+      return;
+    }
+    const QTextBlock block = tc_.block();
+    const QString &text = blockText(block);
+    const int tabSize = config(ConfigTabStop).toInt();
+    tc_.setPosition(block.position() + indexAtColumn(text, column, tabSize), moveMode_);
+  });
+}
+
 void EmacsModeHandler::setAnchor(int position) {
   anchor_ = position;
 }
@@ -723,8 +2868,9 @@ void EmacsModeHandler::indentRegionAction()
 void EmacsModeHandler::indentRegionWithCharacter(QChar typedChar)
 {
   //int savedPos = anchor();
-  int beginLine = lineForPosition(tc_.anchor());
-  int endLine = lineForPosition(tc_.position());
+  int beginLine = 0;
+  int endLine = 0;
+  lines_.linesForPositions(tc_.anchor(), tc_.position(), &beginLine, &endLine);
   if (beginLine > endLine)
     qSwap(beginLine, endLine);
 
@@ -738,18 +2884,18 @@ int EmacsModeHandler::cursorLineInDocument() const
 
 int EmacsModeHandler::linesInDocument() const
 {
-  return tc_.isNull() ? 0 : tc_.document()->blockCount();
+  return document()->blockCount();
 }
 
 int EmacsModeHandler::lastPositionInDocument() const
 {
-  QTextBlock block = tc_.document()->lastBlock();
+  QTextBlock block = document()->lastBlock();
   return block.position() + block.length() - 1;
 }
 
 QString EmacsModeHandler::lineContents(int line) const
 {
-  return tc_.document()->findBlockByNumber(line - 1).text();
+  return document()->findBlockByNumber(line - 1).text();
 }
 
 void EmacsModeHandler::setLineContents(int line, const QString &contents) const
@@ -764,20 +2910,17 @@ void EmacsModeHandler::setLineContents(int line, const QString &contents) const
 
 int EmacsModeHandler::firstPositionInLine(int line) const
 {
-  return tc_.document()->findBlockByNumber(line - 1).position();
+  return lines_.firstPositionInLine(line);
 }
 
 int EmacsModeHandler::lastPositionInLine(int line) const
 {
-  QTextBlock block = tc_.document()->findBlockByNumber(line - 1);
-  return block.position() + block.length() - 1;
+  return lines_.lastPositionInLine(line);
 }
 
 int EmacsModeHandler::lineForPosition(int pos) const
 {
-  QTextCursor tc = tc_;
-  tc.setPosition(pos);
-  return tc.block().blockNumber() + 1;
+  return lines_.lineForPosition(pos);
 }
 
 void EmacsModeHandler::undoAction()
@@ -18,8 +18,15 @@
 #include "emacsmodesettings.hpp"
 #include "shortcut.hpp"
 #include "pluginstate.hpp"
+#include "wordindex.hpp"
+#include "blanklineindex.hpp"
+#include "bracketindex.hpp"
+#include "lineindex.hpp"
+#include "blockchange.hpp"
 
 #include <QtCore/QObject>
+#include <QtCore/QPointer>
+#include <QtCore/QTimer>
 
 #include <QTextEdit>
 #include <QPlainTextEdit>
@@ -36,6 +43,9 @@ enum EventResult
 };
 
 struct Range;
+struct LineSpan;
+class ShellCommand;
+struct WriteResult;
 
 class EmacsModeHandler : public QObject
 {
@@ -53,15 +63,28 @@ signals:
                           const QString &fileName, const QString &contents);
   void writeAllRequested(QString *error);
   void indentRegionRequested(int beginLine, int endLine, QChar typedChar);
+  void wordCompletionsRequested(const QString &prefix, QStringList *words);
+  void symbolDictionaryRequested();
+  void commentTokenRequested(QString *token);
+  void quitRequested();
+  void modifiedBuffersRequested(QList<EmacsModeHandler *> *handlers);
+  void openFileRequested(const QString &fileName);
+  void shellOutputRequested(const QString &command, const QString &output);
+  void largeFileModeChanged(bool large);
 
 public slots:
   void onContentsChanged(int position, int charsRemoved, int charsAdded);
   void onUndoCommandAdded();
+  void flushIndexUpdates();
+  void onShellCommandFinished(int exitCode, const QString &output, const QString &errors);
+  void onRecoveryFinished();
+  void onDirectoryListed();
 
 private:
   bool eventFilter(QObject *ob, QEvent *ev);
 
   void startNewKillBufferEntryIfNecessary();
+  void startNewKillBufferEntryIfNecessary(Action::Id previousActionId);
 
 public:  
   
@@ -82,6 +105,8 @@ public:
 
   bool atEndOfLine() const;
 
+  LineIndex lines_;
+
   int lastPositionInDocument() const; // last valid pos in doc
   int firstPositionInLine(int line) const; // 1 based line, 0 based pos
   int lastPositionInLine(int line) const; // 1 based line, 0 based pos
@@ -97,6 +122,20 @@ public:
 
   QTextBlock block() const;
 
+  // Text of the block last scanned by a motion, kept until the document
+  // changes so repeated motions on a long line do not copy it again.
+  const QString &blockText(const QTextBlock &block) const;
+  mutable QString cachedBlockText_;
+  mutable int cachedBlockNumber_ = -1;
+
+  int forwardWordPosition(int pos) const;
+  int backwardWordPosition(int pos) const;
+  int forwardParagraphPosition(int pos);
+  int backwardParagraphPosition(int pos);
+  bool startsSexp(const QString &text, int column, int blockNumber);
+  int forwardSexpPosition(int pos);  // -1 on error
+  int backwardSexpPosition(int pos); // -1 on error
+
   void indentRegionAction();
   void indentRegionWithCharacter(QChar lastTyped);
 
@@ -106,10 +145,29 @@ public:
   void moveDownAction(int n = 1);
   void moveRightAction(int n = 1);
   void moveLeftAction(int n = 1);
+  void forwardWordAction();
+  void backwardWordAction();
+  void forwardParagraphAction();
+  void backwardParagraphAction();
+  void markParagraphAction();
+  void forwardSexpAction();
+  void backwardSexpAction();
+  void backwardUpListAction();
   void newLineAction();
   void backspaceAction();
   void insertBackSlashAction();
   void insertStraightDelimAction();
+  void scrollUpAction();
+  void scrollDownAction();
+  void recenterTopBottomAction();
+  int contextLines() const;
+  bool isCursorVisible() const;
+  void scrollCursorTo(int y);
+  int recenterState_ = 0; // middle, top, bottom
+
+  void gotoLineAction();
+  void gotoCharAction();
+  void moveToColumnAction();
   void setAnchor(int position);
   void setPosition(int position);
 
@@ -125,6 +183,79 @@ public:
   QChar const firstNonBlankOnLine(int line);
 
   void updateMiniBuffer();
+
+  // Minibuffer input: while a prompt is active, keys edit its text
+  // instead of running commands. Return accepts, C-g or Esc cancels.
+  bool isPrompting() const;
+  void readFromMiniBuffer(const QString &prompt, std::function<void(const QString &)> accept);
+  // As above, but the first key typed answers the prompt.
+  void readCharFromMiniBuffer(const QString &prompt, std::function<void(const QString &)> accept);
+  EventResult handlePromptEvent(QKeyEvent *ev);
+  void showPrompt();
+  QString promptLabel_;
+  QString promptText_;
+  std::function<void(const QString &)> promptAccept_;
+  bool promptReadsChar_ = false;
+
+  // File name prompts list the matching names after the text, Tab
+  // completes. Directories are listed by DirectoryCache in the
+  // background, the prompt is redrawn when a listing arrives.
+  void findFileAction();
+  QStringList fileNameCompletions(const QString &text, int limit, bool *pending) const;
+  void completeFileName();
+  bool promptCompletesFileNames_ = false;
+
+  // Numeric prefix argument (C-u, M-<digit>, M--), cleared after the
+  // next command runs.
+  bool isPrefixArgument(Action::Id id) const;
+  void clearPrefixArgument();
+  int repeatCount() const; // 1 without a prefix argument
+  void digitArgumentAction(int digit);
+  void negativeArgumentAction();
+  void universalArgumentAction();
+  bool hasPrefixArg_ = false;
+  bool prefixDigits_ = false;
+  int prefixArg_ = 1;
+  int prefixSign_ = 1;
+
+  // Keyboard macros: the actions run while recording, with the text
+  // typed into the editor as SelfInsert actions and the answers given
+  // at prompts, which stand in for the prompt when replaying.
+  struct MacroStep
+  {
+    Action action_;
+    QStringList answers_;
+  };
+  typedef std::vector<MacroStep> Macro;
+  bool isMacroCommand(Action::Id id) const;
+  bool recordCoreKey(QKeyEvent *ev, MacroStep *step);
+  void startMacroAction();
+  void endMacroAction();
+  void callMacroAction();
+  void applyMacroToRegionLinesAction();
+  void broadcastToRegionLinesAction();
+  void replayMacro(const Macro &macro);
+  void applyToRegionLines(const Macro &macro);
+  // Replays are one edit block, which holds back contentsChange and
+  // layout until it ends. Only reading an index ends and rejoins it, so
+  // the index sees the edits made so far and undo still sees one step.
+  void beginReplayBlock();
+  void endReplayBlock();
+  void flushReplayedEdits();
+  int replayUndoSteps_ = 0;
+  bool inReplayBlock_ = false;
+  Macro macro_;
+  Macro recordedMacro_;
+  bool recordingMacro_ = false;
+  bool replayingMacro_ = false;
+  QStringList replayAnswers_;
+  bool broadcastNext_ = false;
+
+  // M-| runs one command at a time per buffer
+  void shellCommandOnRegionAction();
+  ShellCommand *shellCommand_ = nullptr;
+  bool shellReplace_ = false;
+
   //    void updateSelection();
   QWidget *editor() const;
   void beginEditBlock();
@@ -153,6 +284,7 @@ public:
   int position() const;
 
   QString selectText(const Range &range) const;
+  QString extractRectangle(int beginLine, int endLine, int beginColumn, int endColumn) const;
 
   // undo handling
   void undoAction();
@@ -179,6 +311,23 @@ public:
   void cleanKillRing();
   void killLineAction();
   void killSymbolAction();
+  void killWordAction();
+  void backwardKillWordAction();
+  void killParagraphAction();
+  void killSexpAction();
+  int findCharPosition(int pos, QChar c, int count) const;
+  void zapToCharAction(bool inclusive);
+  void jumpToCharAction();
+
+  void rectangleBounds(int *beginLine, int *endLine, int *beginColumn, int *endColumn) const;
+  void replaceRectangle(int beginLine, int endLine, int beginColumn, int endColumn,
+                        const std::function<QString(int)> &contents, QString *extracted);
+  void moveToLineColumn(int line, int column);
+  void killRectangleAction();
+  void yankRectangleAction();
+  void stringRectangleAction();
+  void openRectangleAction();
+  void clearRectangleAction();
 
   void yankCurrentAction();
   void yankNextAction();
@@ -188,11 +337,99 @@ public:
 
   void saveToFile(QString const & fileName);
   void saveCurrentFileAction();
-
+  void prepareToSave();
+  void writeInBackground(const QString &fileName,
+                         const std::function<void(const WriteResult &)> &done);
+  void saveSomeBuffersAction();
+  void recoverThisFileAction();
+  void askToSaveBuffers(const QList<QPointer<EmacsModeHandler> > &remaining,
+                        const QList<QPointer<EmacsModeHandler> > &confirmed);
+  void saveBuffers(const QList<QPointer<EmacsModeHandler> > &handlers);
+
+  enum CommentMode { CommentLines, UncommentLines, ToggleComment };
   void commentOutRegionAction();
   void uncommentRegionAction();
+  void commentDwimAction();
+  void regionLines(int *beginLine, int *endLine) const;
+  void commentRegion(CommentMode mode);
+
+  void fillParagraphAction();
+  void setFillColumnAction();
+  bool paragraphLines(const QString &token, int line, int minLine, int maxLine,
+                      int *beginLine, int *endLine) const;
+  void autoFill();
+
+  void deleteTrailingWhitespaceAction();
+  void untabifyAction();
+  void tabifyAction();
+  void whitespaceCleanupAction();
+  void fixWhitespaceInRegion(int fixes);
+  void fixWhitespace(int fixes, int beginLine, int endLine);
+
+  void sortLinesAction(bool numeric);
+  void reverseRegionAction();
+  void deleteDuplicateLinesAction();
+  void rearrangeLines(const std::function<void(const QString &, QVector<LineSpan> *)> &rearrange);
 
   void cancelCurrentCommandAction();
+  void keyboardQuitAction();
+
+  void dabbrevExpandAction();
+  void hippieExpandAction();
+  void expandAbbreviation(Action::Id id,
+                          std::function<QStringList(const QString &, int)> candidates);
+  void syncKillRingSymbols();
+
+  WordIndex wordIndex_;
+  BlankLineIndex blankLines_;
+  BracketIndex brackets_;
+  int blockCount_ = 0; // as of the last contentsChange
+  void updateIndexes(const BlockChange &change);
+
+  // Large-file mode: entered when the document exceeds the configured
+  // size or line length. Motions then use logical lines and the indexes
+  // are brought up to date once typing pauses instead of per keystroke.
+  void updateLargeFileMode();
+  bool isLargeFileMode() const { return largeFileMode_; }
+  // Whether an edit outside of large-file mode may have taken the
+  // document past the limits, looking only at the blocks it touched.
+  bool mayExceedLargeFileLimits(const BlockChange &change) const;
+  bool logicalLines() const; // large-file mode or line-move-visual off
+  void moveByLogicalLines(int n);
+  void forEachLine(int beginLine, int endLine,
+                   const std::function<void(const QString &)> &sink) const;
+  bool largeFileMode_ = false;
+  bool largeFileCheckPending_ = false; // done by the deferred index flush
+  BlockChange pendingChange_;
+  bool hasPendingChange_ = false;
+  QTimer indexTimer_;
+  int goalColumn_ = 0;
+  int goalPosition_ = -1; // where the last logical line motion ended
+
+  // Narrowing: the blocks outside the accessible lines are hidden and
+  // every motion, search and edit stays within them. The bounds are
+  // cursors so they follow edits. narrowBegin_ sits on the newline
+  // before the first accessible line and is null from the first line of
+  // the document, narrowEnd_ on the end of the last accessible line.
+  void narrowToRegionAction();
+  void widenAction();
+  void setOutsideBlocksVisible(bool visible);
+  void updateNarrowing(int position, int charsRemoved, int charsAdded);
+  int narrowedBegin() const;
+  int narrowedEnd() const;
+  void narrowedLines(int *beginLine, int *endLine) const; // 1 based
+  int clampToNarrowing(int pos) const;
+  void keepCursorInNarrowing();
+  bool narrowed_ = false;
+  QTextCursor narrowBegin_;
+  QTextCursor narrowEnd_;
+
+  QString expansionPrefix_;
+  QStringList expansionCandidates_;
+  int expansionNext_ = 0;
+  int expansionStart_ = 0;
+  int expansionEnd_ = 0;
+  QString acceptedExpansion_;
 
   static PluginState pluginState;
 };
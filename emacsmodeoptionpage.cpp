@@ -53,6 +53,33 @@ QWidget *EmacsModeOptionPage::widget()
 
     group_.insert(theEmacsModeSetting(ConfigExpandTab),
                    ui_.checkBoxExpandTabs);
+
+    group_.insert(theEmacsModeSetting(ConfigLineMoveVisual),
+                   ui_.checkBoxLineMoveVisual);
+
+    group_.insert(theEmacsModeSetting(ConfigFillColumn),
+                   ui_.spinBoxFillColumn);
+
+    group_.insert(theEmacsModeSetting(ConfigFillOptimal),
+                   ui_.checkBoxFillOptimal);
+
+    group_.insert(theEmacsModeSetting(ConfigAutoFill),
+                   ui_.checkBoxAutoFill);
+
+    group_.insert(theEmacsModeSetting(ConfigDeleteTrailingWhitespaceOnSave),
+                   ui_.checkBoxDeleteTrailingWhitespaceOnSave);
+
+    group_.insert(theEmacsModeSetting(ConfigAutoSave),
+                   ui_.checkBoxAutoSave);
+
+    group_.insert(theEmacsModeSetting(ConfigMakeBackupFiles),
+                   ui_.checkBoxMakeBackupFiles);
+
+    group_.insert(theEmacsModeSetting(ConfigLargeFileSize),
+                   ui_.spinBoxLargeFileSize);
+
+    group_.insert(theEmacsModeSetting(ConfigLargeFileLineLength),
+                   ui_.spinBoxLargeFileLineLength);
   }
   return widget_;
 }
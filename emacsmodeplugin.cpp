@@ -19,6 +19,9 @@
 #include "emacsmodesettings.hpp"
 #include "emacsmodehandler.hpp"
 #include "emacsmodeoptionpage.hpp"
+#include "documentwriter.hpp"
+#include "filecompletion.hpp"
+#include "textscan.hpp"
 #include "ui_emacsmodeoptions.h"
 
 #include <coreplugin/coreconstants.h>
@@ -27,6 +30,7 @@
 #include <coreplugin/find/findplugin.h>
 #include <coreplugin/documentmanager.h>
 #include <coreplugin/icore.h>
+#include <coreplugin/messagemanager.h>
 #include <coreplugin/idocument.h>
 #include <coreplugin/id.h>
 #include <coreplugin/statusbarmanager.h>
@@ -37,11 +41,16 @@
 #include <texteditor/indenter.h>
 
 #include <utils/qtcassert.h>
+#include <utils/mimetypes/mimedatabase.h>
 
 #include <extensionsystem/pluginmanager.h>
 
 #include <QDebug>
+#include <QFileInfo>
 #include <QObject>
+#include <QPointer>
+#include <QSet>
+#include <QTimer>
 
 using namespace TextEditor;
 using namespace Core;
@@ -49,6 +58,33 @@ using namespace Core;
 namespace EmacsMode {
 namespace Internal {
 
+static const int MaxFileNameHistory = 100;
+
+// Blocks whose indentation is computed between two event loop iterations.
+static const int IndentBatchSize = 500;
+
+// Line comment tokens by mime type, the first type the document's
+// mime type inherits from wins.
+static const struct {
+  const char *mimeType;
+  const char *token;
+} commentTokens[] = {
+  { "text/x-python", "#" },
+  { "application/x-shellscript", "#" },
+  { "text/x-cmake", "#" },
+  { "text/x-cmake-project", "#" },
+  { "text/x-makefile", "#" },
+  { "application/vnd.qt.qmakeprofile", "#" },
+  { "application/x-perl", "#" },
+  { "application/x-ruby", "#" },
+  { "application/x-yaml", "#" },
+  { "text/x-sql", "--" },
+  { "text/x-lua", "--" },
+  { "text/x-haskell", "--" },
+  { "text/x-tex", "%" },
+  { "text/x-emacs-lisp", ";;" }
+};
+
 ///////////////////////////////////////////////////////////////////////
 //
 // EmacsModePluginPrivate
@@ -76,25 +112,60 @@ private slots:
   void onCoreAboutToClose();
   void editorOpened(Core::IEditor *);
   void editorAboutToClose(Core::IEditor *);
+  void currentEditorChanged(Core::IEditor *);
 
   void setUseEmacsMode(const QVariant &value);
   void setUseEmacsModeInternal(bool on);
+  void updateLargeFileModes();
   void quitEmacsMode();
 
   void resetCommandBuffer();
   void showCommandBuffer(const QString &contents, int messageLevel);
+  void showLargeFileMode(bool large);
 
   void indentRegion(int beginBlock, int endBlock, QChar typedChar);
+  void continueIndentation();
+  void cancelIndentation();
+  void collectWordCompletions(const QString &prefix, QStringList *words);
+  void indexAllBuffers();
+  void provideCommentToken(QString *token);
+  void showShellOutput(const QString &command, const QString &output);
+  void collectModifiedBuffers(QList<EmacsModeHandler *> *handlers);
+  void openFile(const QString &fileName);
 
   void writeSettings();
   void readSettings();
 
 private:
+  // Region indentation in progress: a batch of lines is indented per
+  // event loop iteration while nothing else changes the document. The
+  // batches after the first edit join its edit block, so the whole
+  // region is one undo step.
+  struct IndentJob
+  {
+    QPointer<TextEditorWidget> editor;
+    TabSettings tabSettings;
+    QChar typedChar;
+    int revision = 0;
+    bool edited = false;
+    QTextBlock next;
+    int beginBlock = 0; // 0 based, inclusive
+    int endBlock = 0;
+  };
+
+  void indentBatch(IndentJob &job);
+  void addToFileNameHistory(const QFileInfo &fileInfo);
+
   EmacsModePlugin *q;
   QHash<IEditor *, EmacsModeHandler *> m_editorToHandler;
 
   MiniBuffer *m_miniBuffer = nullptr;
   EmacsModePluginRunData *m_runData = nullptr;
+  DocumentSaver *m_saver = nullptr;
+  DirectoryCache *m_directories = nullptr;
+
+  QHash<EmacsModeHandler *, IndentJob> m_indentJobs;
+  QTimer m_indentTimer;
 };
 
 class EmacsModePluginRunData
@@ -110,6 +181,8 @@ EmacsModePluginPrivate::EmacsModePluginPrivate()
 
 EmacsModePluginPrivate::~EmacsModePluginPrivate()
 {
+  delete m_saver;
+  m_saver = nullptr;
 }
 
 void EmacsModePluginPrivate::onCoreAboutToClose()
@@ -126,11 +199,16 @@ void EmacsModePluginPrivate::aboutToShutdown()
 
     StatusBarManager::destroyStatusBarWidget(m_miniBuffer);
     m_miniBuffer = nullptr;
+
+    delete m_directories;
+    m_directories = nullptr;
 }
 
 bool EmacsModePluginPrivate::initialize()
 {
   m_runData = new EmacsModePluginRunData;
+  m_saver = new DocumentSaver;
+  m_directories = new DirectoryCache;
   Context globalcontext(Core::Constants::C_GLOBAL);
 
   readSettings();
@@ -142,10 +220,20 @@ bool EmacsModePluginPrivate::initialize()
           this, SLOT(editorAboutToClose(Core::IEditor*)));
   connect(EditorManager::instance(), SIGNAL(editorOpened(Core::IEditor*)),
           this, SLOT(editorOpened(Core::IEditor*)));
+  connect(EditorManager::instance(), SIGNAL(currentEditorChanged(Core::IEditor*)),
+          this, SLOT(currentEditorChanged(Core::IEditor*)));
 
   connect(theEmacsModeSetting(ConfigUseEmacsMode), SIGNAL(valueChanged(QVariant)),
           this, SLOT(setUseEmacsMode(QVariant)));
 
+  m_indentTimer.setSingleShot(true);
+  m_indentTimer.setInterval(0);
+  connect(&m_indentTimer, SIGNAL(timeout()), this, SLOT(continueIndentation()));
+  connect(theEmacsModeSetting(ConfigLargeFileSize), SIGNAL(valueChanged(QVariant)),
+          this, SLOT(updateLargeFileModes()));
+  connect(theEmacsModeSetting(ConfigLargeFileLineLength), SIGNAL(valueChanged(QVariant)),
+          this, SLOT(updateLargeFileModes()));
+
   return true;
 }
 
@@ -207,14 +295,32 @@ void EmacsModePluginPrivate::editorOpened(IEditor *editor)
 
   connect(handler, SIGNAL(commandBufferChanged(QString,int)),
           SLOT(showCommandBuffer(QString, int)));
+  connect(handler, SIGNAL(largeFileModeChanged(bool)),
+          SLOT(showLargeFileMode(bool)));
   connect(handler, SIGNAL(indentRegionRequested(int,int,QChar)),
           SLOT(indentRegion(int,int,QChar)));
+  connect(handler, SIGNAL(quitRequested()),
+          SLOT(cancelIndentation()));
+  connect(handler, SIGNAL(wordCompletionsRequested(QString,QStringList*)),
+          SLOT(collectWordCompletions(QString,QStringList*)));
+  connect(handler, SIGNAL(symbolDictionaryRequested()),
+          SLOT(indexAllBuffers()));
+  connect(handler, SIGNAL(commentTokenRequested(QString*)),
+          SLOT(provideCommentToken(QString*)));
+  connect(handler, SIGNAL(shellOutputRequested(QString,QString)),
+          SLOT(showShellOutput(QString,QString)));
+  connect(handler, SIGNAL(modifiedBuffersRequested(QList<EmacsModeHandler*>*)),
+          SLOT(collectModifiedBuffers(QList<EmacsModeHandler*>*)));
+  connect(handler, SIGNAL(openFileRequested(QString)),
+          SLOT(openFile(QString)));
 
   connect(ICore::instance(), SIGNAL(saveSettingsRequested()),
           SLOT(writeSettings()));
 
   handler->setCurrentFileName(editor->document()->filePath().toString());
+  addToFileNameHistory(editor->document()->filePath().toFileInfo());
   handler->installEventFilter();
+  handler->updateLargeFileMode();
 
   // pop up the bar
   if (theEmacsModeSetting(ConfigUseEmacsMode)->value().toBool()) {
@@ -225,9 +331,18 @@ void EmacsModePluginPrivate::editorOpened(IEditor *editor)
 
 void EmacsModePluginPrivate::editorAboutToClose(IEditor *editor)
 {
+  m_indentJobs.remove(m_editorToHandler.value(editor));
   m_editorToHandler.remove(editor);
 }
 
+// The mini buffer shows whether the current editor is in large-file mode.
+void EmacsModePluginPrivate::currentEditorChanged(IEditor *editor)
+{
+  EmacsModeHandler *handler = m_editorToHandler.value(editor);
+  if (m_miniBuffer && theEmacsModeSetting(ConfigUseEmacsMode)->value().toBool())
+    m_miniBuffer->setIndicator(handler && handler->isLargeFileMode() ? tr("Large file") : QString());
+}
+
 void EmacsModePluginPrivate::setUseEmacsMode(const QVariant &value)
 {
   bool on = value.toBool();
@@ -240,6 +355,8 @@ void EmacsModePluginPrivate::setUseEmacsModeInternal(bool on)
     foreach (IEditor *editor, m_editorToHandler.keys())
       m_editorToHandler[editor]->setupWidget();
   } else {
+    if (m_miniBuffer)
+      m_miniBuffer->setIndicator(QString());
     foreach (IEditor *editor, m_editorToHandler.keys()) {
       if (TextDocument *textDocument =
           qobject_cast<TextDocument *>(editor->document())) {
@@ -249,6 +366,12 @@ void EmacsModePluginPrivate::setUseEmacsModeInternal(bool on)
   }
 }
 
+void EmacsModePluginPrivate::updateLargeFileModes()
+{
+  foreach (EmacsModeHandler *handler, m_editorToHandler)
+    handler->updateLargeFileMode();
+}
+
 void EmacsModePluginPrivate::indentRegion(int beginBlock, int endBlock,
                                           QChar typedChar)
 {
@@ -260,33 +383,194 @@ void EmacsModePluginPrivate::indentRegion(int beginBlock, int endBlock,
   if (!bt)
     return;
 
-  TabSettings tabSettings;
-  tabSettings.m_indentSize = theEmacsModeSetting(ConfigShiftWidth)->value().toInt();
-  tabSettings.m_tabSize = theEmacsModeSetting(ConfigTabStop)->value().toInt();
-  tabSettings.m_tabPolicy = theEmacsModeSetting(ConfigExpandTab)->value().toBool()
+  IndentJob job;
+  job.editor = bt;
+  job.tabSettings.m_indentSize = theEmacsModeSetting(ConfigShiftWidth)->value().toInt();
+  job.tabSettings.m_tabSize = theEmacsModeSetting(ConfigTabStop)->value().toInt();
+  job.tabSettings.m_tabPolicy = theEmacsModeSetting(ConfigExpandTab)->value().toBool()
       ? TabSettings::SpacesOnlyTabPolicy : TabSettings::TabsOnlyTabPolicy;
+  job.typedChar = typedChar;
+  job.revision = bt->document()->revision();
+  job.next = bt->document()->findBlockByNumber(beginBlock - 1);
+  job.beginBlock = beginBlock - 1;
+  job.endBlock = endBlock - 1;
+  m_indentJobs[handler] = job;
+
+  // small regions finish within the first batch
+  continueIndentation();
+}
+
+void EmacsModePluginPrivate::continueIndentation()
+{
+  foreach (EmacsModeHandler *handler, m_indentJobs.keys()) {
+    IndentJob &job = m_indentJobs[handler];
+    if (!job.editor || job.editor->document()->revision() != job.revision) {
+      m_indentJobs.remove(handler);
+      showCommandBuffer(tr("Indentation aborted, the buffer was changed"), MessageError);
+      continue;
+    }
 
-  QTextDocument *doc = bt->document();
-  QTextBlock startBlock = doc->findBlockByNumber(beginBlock - 1);
+    indentBatch(job);
 
-  // Record line lenghts for mark adjustments
-  QVector<int> lineLengths(endBlock - beginBlock + 1);
-  QTextBlock block = startBlock;
+    if (job.next.isValid() && job.next.blockNumber() <= job.endBlock) {
+      const int done = job.next.blockNumber() - job.beginBlock;
+      const int total = job.endBlock - job.beginBlock + 1;
+      showCommandBuffer(tr("Indenting region... %1% (C-g to quit)").arg(100 * done / total),
+                        MessageShowCmd);
+      continue;
+    }
+
+    if (job.endBlock - job.beginBlock >= IndentBatchSize)
+      showCommandBuffer(tr("Indenting region... done"), MessageInfo);
+    m_indentJobs.remove(handler);
+  }
+
+  if (!m_indentJobs.isEmpty())
+    m_indentTimer.start();
+}
 
-  for (int i = beginBlock; i <= endBlock; ++i) {
-    lineLengths[i - beginBlock] = block.text().length();
-    if (typedChar == 0 && block.text().simplified().isEmpty()) {
-      // clear empty lines
-      QTextCursor cursor(block);
-      while (!cursor.atBlockEnd())
-        cursor.deleteChar();
+// The indenter indents each line itself: only indentBlock knows the
+// padding that aligns continuation lines and which typed characters are
+// electric. Joining an edit block that holds no edit would merge the
+// region into the undo step before it, so batches that change nothing
+// begin a new one.
+void EmacsModePluginPrivate::indentBatch(IndentJob &job)
+{
+  QTextDocument *doc = job.editor->document();
+  Indenter *indenter = job.editor->textDocument()->indenter();
+  const int revision = doc->revision();
+
+  QTextCursor cursor(doc);
+  if (job.edited)
+    cursor.joinPreviousEditBlock();
+  else
+    cursor.beginEditBlock();
+  for (int i = 0; i < IndentBatchSize && job.next.isValid()
+       && job.next.blockNumber() <= job.endBlock; ++i, job.next = job.next.next()) {
+    const QString text = job.next.text();
+    // blank lines are cleared unless indenting for a typed character
+    if (job.typedChar == 0 && isBlank(text)) {
+      if (text.isEmpty())
+        continue;
+      cursor.setPosition(job.next.position());
+      cursor.setPosition(job.next.position() + text.size(), QTextCursor::KeepAnchor);
+      cursor.removeSelectedText();
     } else {
-      bt->textDocument()->indenter()->indentBlock(block, typedChar, tabSettings);
+      indenter->indentBlock(job.next, job.typedChar, job.tabSettings);
+    }
+  }
+  cursor.endEditBlock();
+
+  job.edited = job.edited || doc->revision() != revision;
+  job.revision = doc->revision();
+}
+
+void EmacsModePluginPrivate::cancelIndentation()
+{
+  EmacsModeHandler *handler = qobject_cast<EmacsModeHandler *>(sender());
+  if (m_indentJobs.remove(handler))
+    showCommandBuffer(tr("Indentation cancelled"), MessageInfo);
+}
+
+void EmacsModePluginPrivate::collectWordCompletions(const QString &prefix, QStringList *words)
+{
+  EmacsModeHandler *requester = qobject_cast<EmacsModeHandler *>(sender());
+
+  // several editors may show the same document
+  QSet<QTextDocument *> visited;
+  if (requester)
+    visited.insert(requester->document());
+
+  foreach (EmacsModeHandler *handler, m_editorToHandler) {
+    if (visited.contains(handler->document()))
+      continue;
+    visited.insert(handler->document());
+    handler->flushIndexUpdates();
+    *words += handler->wordIndex_.wordsWithPrefix(prefix);
+  }
+}
+
+void EmacsModePluginPrivate::indexAllBuffers()
+{
+  // words are tokenized once per buffer and then kept up to date by edits
+  foreach (EmacsModeHandler *handler, m_editorToHandler) {
+    handler->flushIndexUpdates();
+    handler->wordIndex_.ensureBuilt();
+  }
+}
+
+void EmacsModePluginPrivate::provideCommentToken(QString *token)
+{
+  EmacsModeHandler *handler = qobject_cast<EmacsModeHandler *>(sender());
+  IEditor *editor = m_editorToHandler.key(handler);
+  if (!editor)
+    return;
+
+  // plain text has no comments, it is filled as a whole; anything
+  // not listed is assumed to use C++ style comments
+  const Utils::MimeType mimeType = Utils::mimeTypeForName(editor->document()->mimeType());
+  if (mimeType.name() == QLatin1String("text/plain")
+      || mimeType.name() == QLatin1String("text/markdown")) {
+    token->clear();
+    return;
+  }
+  for (const auto &entry : commentTokens) {
+    if (mimeType.inherits(QLatin1String(entry.mimeType))) {
+      *token = QLatin1String(entry.token);
+      return;
     }
-    block = block.next();
   }
 }
 
+void EmacsModePluginPrivate::showShellOutput(const QString &command, const QString &output)
+{
+  MessageManager::write(QLatin1String("$ ") + command, MessageManager::ModeSwitch);
+  MessageManager::write(output, MessageManager::ModeSwitch);
+}
+
+void EmacsModePluginPrivate::collectModifiedBuffers(QList<EmacsModeHandler *> *handlers)
+{
+  // the requester's buffer first; several editors may show the same document
+  EmacsModeHandler *requester = qobject_cast<EmacsModeHandler *>(sender());
+  QList<IEditor *> editors = m_editorToHandler.keys();
+  if (IEditor *editor = m_editorToHandler.key(requester))
+    editors.prepend(editor);
+
+  QSet<IDocument *> visited;
+  foreach (IEditor *editor, editors) {
+    EmacsModeHandler *handler = m_editorToHandler.value(editor);
+    IDocument *document = editor->document();
+    if (visited.contains(document))
+      continue;
+    visited.insert(document);
+    if (document->isModified() && !document->filePath().isEmpty())
+      handlers->append(handler);
+  }
+}
+
+void EmacsModePluginPrivate::openFile(const QString &fileName)
+{
+  EditorManager::openEditor(fileName);
+}
+
+void EmacsModePluginPrivate::addToFileNameHistory(const QFileInfo &fileInfo)
+{
+  const QString fileName = fileInfo.fileName();
+  if (fileName.isEmpty())
+    return;
+
+  QStringList &history = EmacsModeHandler::pluginState.fileNameHistory_;
+  history.removeAll(fileName);
+  history.prepend(fileName);
+  while (history.size() > MaxFileNameHistory)
+    history.removeLast();
+
+  QStringList words = history;
+  foreach (const QString &name, history)
+    words.append(QFileInfo(name).completeBaseName());
+  EmacsModeHandler::pluginState.symbols_.setSourceWords(SymbolDictionary::FileNameSource, words);
+}
+
 void EmacsModePluginPrivate::quitEmacsMode()
 {
   theEmacsModeSetting(ConfigUseEmacsMode)->setValue(false);
@@ -303,6 +587,16 @@ void EmacsModePluginPrivate::showCommandBuffer(QString const& contents, int mess
   m_miniBuffer->setContents(contents, messageLevel);
 }
 
+// Handlers of editors in the background switch too, only the current
+// one is shown.
+void EmacsModePluginPrivate::showLargeFileMode(bool large)
+{
+  EmacsModeHandler *handler = qobject_cast<EmacsModeHandler *>(sender());
+  if (!m_miniBuffer || handler != m_editorToHandler.value(EditorManager::currentEditor()))
+    return;
+  m_miniBuffer->setIndicator(large ? tr("Large file") : QString());
+}
+
 
 ///////////////////////////////////////////////////////////////////////
 //
@@ -330,7 +624,11 @@ bool EmacsModePlugin::initialize(const QStringList &arguments, QString *errorMes
 ExtensionSystem::IPlugin::ShutdownFlag EmacsModePlugin::aboutToShutdown()
 {
   d->aboutToShutdown();
-  return SynchronousShutdown;
+  // saves still being written are finished first
+  if (d->m_saver->isIdle())
+    return SynchronousShutdown;
+  connect(d->m_saver, SIGNAL(idle()), this, SIGNAL(asynchronousShutdownFinished()));
+  return AsynchronousShutdown;
 }
 
 void EmacsModePlugin::extensionsInitialized()
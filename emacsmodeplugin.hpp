@@ -39,6 +39,29 @@ private:
   virtual ShutdownFlag aboutToShutdown() override;
   virtual void extensionsInitialized() override;
 
+#ifdef WITH_TESTS
+private slots:
+  void test_textScan_data();
+  void test_textScan();
+  void test_textScanColumns_data();
+  void test_textScanColumns();
+  void test_benchFirstNonBlank_data();
+  void test_benchFirstNonBlank();
+  void test_benchTrailingWhitespace_data();
+  void test_benchTrailingWhitespace();
+  void test_macroReplayUpdatesIndexes();
+  void test_macroReplayOnRegionLinesUpdatesIndexes();
+  void test_autoSaveJournal();
+  void test_fillParagraph_data();
+  void test_fillParagraph();
+  void test_sortLines_data();
+  void test_sortLines();
+  void test_sameLines();
+  void test_largeFileModeFollowsEdits();
+  void test_symbolRanking();
+  void test_bracketMatching();
+#endif
+
 private:
   friend class EmacsModePluginPrivate;
   EmacsModePluginPrivate *d;
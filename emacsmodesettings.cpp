@@ -123,6 +123,52 @@ EmacsModeSettings *theEmacsModeSettings()
   item->setSettingsKey(group, QLatin1String("ExpandTabs"));
   instance->insertItem(ConfigExpandTab, item, QLatin1String("expandtabs"), QLatin1String("et"));
 
+  item = new SavedAction(instance);
+  item->setDefaultValue(true);
+  item->setSettingsKey(group, QLatin1String("LineMoveVisual"));
+  instance->insertItem(ConfigLineMoveVisual, item, QLatin1String("linemovevisual"));
+
+  item = new SavedAction(instance);
+  item->setDefaultValue(10 * 1024 * 1024);
+  item->setSettingsKey(group, QLatin1String("LargeFileSize"));
+  instance->insertItem(ConfigLargeFileSize, item, QLatin1String("largefilesize"));
+
+  item = new SavedAction(instance);
+  item->setDefaultValue(10000);
+  item->setSettingsKey(group, QLatin1String("LargeFileLineLength"));
+  instance->insertItem(ConfigLargeFileLineLength, item, QLatin1String("largefilelinelength"));
+
+  item = new SavedAction(instance);
+  item->setDefaultValue(70);
+  item->setSettingsKey(group, QLatin1String("FillColumn"));
+  instance->insertItem(ConfigFillColumn, item, QLatin1String("fillcolumn"));
+
+  item = new SavedAction(instance);
+  item->setDefaultValue(false);
+  item->setSettingsKey(group, QLatin1String("FillOptimal"));
+  instance->insertItem(ConfigFillOptimal, item, QLatin1String("filloptimal"));
+
+  item = new SavedAction(instance);
+  item->setDefaultValue(false);
+  item->setSettingsKey(group, QLatin1String("AutoFill"));
+  instance->insertItem(ConfigAutoFill, item, QLatin1String("autofill"));
+
+  item = new SavedAction(instance);
+  item->setDefaultValue(false);
+  item->setSettingsKey(group, QLatin1String("DeleteTrailingWhitespaceOnSave"));
+  instance->insertItem(ConfigDeleteTrailingWhitespaceOnSave, item,
+                       QLatin1String("deletetrailingwhitespaceonsave"));
+
+  item = new SavedAction(instance);
+  item->setDefaultValue(true);
+  item->setSettingsKey(group, QLatin1String("AutoSave"));
+  instance->insertItem(ConfigAutoSave, item, QLatin1String("autosave"));
+
+  item = new SavedAction(instance);
+  item->setDefaultValue(true);
+  item->setSettingsKey(group, QLatin1String("MakeBackupFiles"));
+  instance->insertItem(ConfigMakeBackupFiles, item, QLatin1String("makebackupfiles"));
+
   return instance;
 }
 
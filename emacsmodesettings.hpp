@@ -29,7 +29,16 @@ enum EmacsModeSettingsCode
   ConfigUseEmacsMode,
   ConfigTabStop,
   ConfigShiftWidth,
-  ConfigExpandTab
+  ConfigExpandTab,
+  ConfigLineMoveVisual,
+  ConfigLargeFileSize,      // in characters
+  ConfigLargeFileLineLength, // longest line in characters
+  ConfigFillColumn,
+  ConfigFillOptimal,
+  ConfigAutoFill,
+  ConfigDeleteTrailingWhitespaceOnSave,
+  ConfigAutoSave,
+  ConfigMakeBackupFiles
 };
 
 class EmacsModeSettings : public QObject
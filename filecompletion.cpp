@@ -0,0 +1,195 @@
+/**************************************************************************
+**
+** Copyright (c) 2014 Siarhei Rachytski (siarhei.rachytski@gmail.com)
+**
+** GNU Lesser General Public License Usage
+**
+** This file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+
+#include "filecompletion.hpp"
+
+#include <QtConcurrent/QtConcurrentRun>
+#include <QtCore/QDirIterator>
+#include <QtCore/QFileInfo>
+#include <QtCore/QFileSystemWatcher>
+#include <QtCore/QFutureWatcher>
+
+#include <algorithm>
+
+namespace EmacsMode {
+namespace Internal {
+
+// Directories kept; the least recently used one is dropped first.
+static const int MaxCachedDirectories = 256;
+
+static DirectoryCache *theCache = nullptr;
+
+// A bit for each letter, digits share the remaining six.
+static quint32 characterMask(const QString &lowerName)
+{
+  quint32 mask = 0;
+  for (const QChar c : lowerName) {
+    const ushort u = c.unicode();
+    if (u >= 'a' && u <= 'z')
+      mask |= 1u << (u - 'a');
+    else if (u >= '0' && u <= '9')
+      mask |= 1u << (26 + (u - '0') % 6);
+  }
+  return mask;
+}
+
+DirectoryListing listDirectory(const QString &dir)
+{
+  DirectoryListing listing;
+  listing.exists_ = QFileInfo(dir).isDir();
+  QDirIterator it(dir, QDir::AllEntries | QDir::NoDotAndDotDot | QDir::Hidden | QDir::System);
+  while (it.hasNext()) {
+    it.next();
+    const QFileInfo info = it.fileInfo();
+    listing.names_.append(info.isDir() ? info.fileName() + QLatin1Char('/') : info.fileName());
+  }
+  std::sort(listing.names_.begin(), listing.names_.end(), [](const QString &a, const QString &b) {
+    return a.compare(b, Qt::CaseInsensitive) < 0;
+  });
+
+  listing.lowerNames_.reserve(listing.names_.size());
+  listing.masks_.reserve(listing.names_.size());
+  for (const QString &name : listing.names_) {
+    listing.lowerNames_.append(name.toLower());
+    listing.masks_.append(characterMask(listing.lowerNames_.last()));
+  }
+  return listing;
+}
+
+static bool containsInOrder(const QString &name, const QString &pattern)
+{
+  int i = 0;
+  for (const QChar c : name) {
+    if (i < pattern.size() && c == pattern.at(i))
+      ++i;
+  }
+  return i == pattern.size();
+}
+
+QStringList fuzzyMatches(const DirectoryListing &listing, const QString &pattern, int limit)
+{
+  const QString lowerPattern = pattern.toLower();
+  const quint32 patternMask = characterMask(lowerPattern);
+  const int count = listing.names_.size();
+  QStringList matches;
+  QVector<int> others; // matching, but not as a prefix
+
+  for (int i = 0; i < count && (limit < 0 || matches.size() < limit); ++i) {
+    if ((listing.masks_.at(i) & patternMask) != patternMask)
+      continue;
+    const QString &name = listing.lowerNames_.at(i);
+    if (name.startsWith(lowerPattern))
+      matches.append(listing.names_.at(i));
+    else if (containsInOrder(name, lowerPattern))
+      others.append(i);
+  }
+  for (int i = 0; i < others.size() && (limit < 0 || matches.size() < limit); ++i)
+    matches.append(listing.names_.at(others.at(i)));
+  return matches;
+}
+
+DirectoryCache::DirectoryCache(QObject *parent)
+  : QObject(parent)
+  , watcher_(new QFileSystemWatcher)
+{
+  watcher_->moveToThread(&watcherThread_);
+  connect(&watcherThread_, SIGNAL(finished()), watcher_, SLOT(deleteLater()));
+  connect(watcher_, SIGNAL(directoryChanged(QString)), SLOT(onDirectoryChanged(QString)));
+  watcherThread_.start(QThread::LowPriority);
+  theCache = this;
+}
+
+DirectoryCache::~DirectoryCache()
+{
+  theCache = nullptr;
+  watcherThread_.quit();
+  watcherThread_.wait();
+}
+
+DirectoryCache *DirectoryCache::instance()
+{
+  return theCache;
+}
+
+bool DirectoryCache::listing(const QString &dir, DirectoryListing *listing)
+{
+  auto it = listings_.constFind(dir);
+  if (it == listings_.constEnd()) {
+    read(dir);
+    return false;
+  }
+  *listing = it.value();
+  if (recent_.last() != dir) {
+    recent_.removeOne(dir);
+    recent_.append(dir);
+  }
+  return true;
+}
+
+void DirectoryCache::read(const QString &dir)
+{
+  for (const QString &reading : reads_) {
+    if (reading == dir)
+      return;
+  }
+  auto *watcher = new QFutureWatcher<DirectoryListing>(this);
+  reads_.insert(watcher, dir);
+  connect(watcher, SIGNAL(finished()), SLOT(onListed()));
+  watcher->setFuture(QtConcurrent::run(listDirectory, dir));
+}
+
+void DirectoryCache::onListed()
+{
+  auto *watcher = static_cast<QFutureWatcher<DirectoryListing> *>(sender());
+  const QString dir = reads_.take(watcher);
+  const DirectoryListing listing = watcher->result();
+  watcher->deleteLater();
+
+  // a missing directory is remembered as empty, but cannot be watched
+  if (!listings_.contains(dir)) {
+    recent_.append(dir);
+    if (listing.exists_)
+      watch(dir, true);
+  }
+  listings_.insert(dir, listing);
+  while (recent_.size() > MaxCachedDirectories) {
+    const QString dropped = recent_.takeFirst();
+    if (listings_.take(dropped).exists_)
+      watch(dropped, false);
+  }
+  emit listed(dir);
+}
+
+void DirectoryCache::onDirectoryChanged(const QString &dir)
+{
+  // read again right away, a prompt may be showing it
+  if (listings_.contains(dir))
+    read(dir);
+}
+
+void DirectoryCache::watch(const QString &dir, bool on)
+{
+  QFileSystemWatcher *watcher = watcher_;
+  QMetaObject::invokeMethod(watcher_, [watcher, dir, on]() {
+    if (on)
+      watcher->addPath(dir);
+    else
+      watcher->removePath(dir);
+  }, Qt::QueuedConnection);
+}
+
+}
+}
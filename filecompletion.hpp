@@ -0,0 +1,87 @@
+/**************************************************************************
+**
+** Copyright (c) 2014 Siarhei Rachytski (siarhei.rachytski@gmail.com)
+**
+** GNU Lesser General Public License Usage
+**
+** This file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+
+#pragma once
+
+#include <QtCore/QHash>
+#include <QtCore/QObject>
+#include <QtCore/QStringList>
+#include <QtCore/QThread>
+#include <QtCore/QVector>
+
+class QFileSystemWatcher;
+
+template <typename T> class QFutureWatcher;
+
+namespace EmacsMode {
+namespace Internal {
+
+// The entries of a directory, sorted ignoring case, with what fuzzy
+// matching needs computed up front.
+struct DirectoryListing
+{
+  QStringList names_;      // directories end in '/'
+  QStringList lowerNames_; // names_ in lower case
+  QVector<quint32> masks_; // the letters and digits in each name, a bit each
+  bool exists_ = false;
+};
+
+DirectoryListing listDirectory(const QString &dir);
+
+// The names that start with pattern, ignoring case, followed by those
+// that contain its characters in order; at most limit of them, or all
+// of them for a negative limit.
+QStringList fuzzyMatches(const DirectoryListing &listing, const QString &pattern, int limit);
+
+// Directory listings for file name completion. A directory is read on
+// a worker thread the first time it is asked for, and its listing is
+// kept until QFileSystemWatcher reports a change; then it is read
+// again. The watcher lives on a thread of its own, so the UI thread
+// never touches the file system. Owned by the plugin.
+class DirectoryCache : public QObject
+{
+  Q_OBJECT
+
+public:
+  explicit DirectoryCache(QObject *parent = nullptr);
+  ~DirectoryCache();
+
+  static DirectoryCache *instance();
+
+  // The listing of dir if it is cached. Otherwise false is returned and
+  // listed() is emitted once dir has been read.
+  bool listing(const QString &dir, DirectoryListing *listing);
+
+signals:
+  void listed(const QString &dir);
+
+private slots:
+  void onListed();
+  void onDirectoryChanged(const QString &dir);
+
+private:
+  void read(const QString &dir);
+  void watch(const QString &dir, bool on);
+
+  QHash<QString, DirectoryListing> listings_;
+  QStringList recent_;  // cached directories, least recently used first
+  QHash<QFutureWatcher<DirectoryListing> *, QString> reads_;
+  QThread watcherThread_;
+  QFileSystemWatcher *watcher_; // owned by watcherThread_
+};
+
+}
+}
@@ -0,0 +1,216 @@
+/**************************************************************************
+**
+** Copyright (c) 2014 Siarhei Rachytski (siarhei.rachytski@gmail.com)
+**
+** GNU Lesser General Public License Usage
+**
+** This file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+
+#include "fill.hpp"
+#include "textscan.hpp"
+
+#include <QtCore/QtGlobal>
+
+#include <limits>
+
+namespace EmacsMode {
+namespace Internal {
+
+static QVector<int> greedyBreaks(const QVector<int> &wordWidths, int firstWidth, int width)
+{
+  QVector<int> breaks;
+  int lineWidth = firstWidth;
+  int used = -1; // nothing on the line yet
+  for (int i = 0; i < wordWidths.size(); ++i) {
+    if (used >= 0 && used + 1 + wordWidths.at(i) > lineWidth) {
+      lineWidth = width;
+      used = -1;
+    }
+    if (used < 0) {
+      breaks.append(i);
+      used = wordWidths.at(i);
+    } else {
+      used += 1 + wordWidths.at(i);
+    }
+  }
+  return breaks;
+}
+
+// Minimises the sum of the squared free columns of every line but the
+// last. Only lines that fit are considered, so the work per word is
+// bounded by the number of words on a line.
+static QVector<int> optimalBreaks(const QVector<int> &wordWidths, int firstWidth, int width)
+{
+  const int count = wordWidths.size();
+  QVector<qint64> cost(count + 1, std::numeric_limits<qint64>::max());
+  QVector<int> start(count + 1, 0);
+  cost[0] = 0;
+
+  for (int end = 1; end <= count; ++end) {
+    int used = -1;
+    for (int first = end - 1; first >= 0; --first) {
+      used += 1 + wordWidths.at(first);
+      const int lineWidth = first == 0 ? firstWidth : width;
+      const bool single = first == end - 1;
+      if (used > lineWidth && !single)
+        break;
+      if (cost.at(first) == std::numeric_limits<qint64>::max())
+        continue;
+      const qint64 slack = used > lineWidth ? 0 : lineWidth - used;
+      const qint64 lineCost = end == count ? 0 : slack * slack;
+      if (cost.at(first) + lineCost < cost.at(end)) {
+        cost[end] = cost.at(first) + lineCost;
+        start[end] = first;
+      }
+    }
+  }
+
+  QVector<int> breaks;
+  for (int end = count; end > 0; end = start.at(end))
+    breaks.prepend(start.at(end));
+  return breaks;
+}
+
+QVector<int> breakLines(const QVector<int> &wordWidths, int firstWidth, int width, FillMode mode)
+{
+  firstWidth = qMax(firstWidth, 1);
+  width = qMax(width, 1);
+  return mode == OptimalFill ? optimalBreaks(wordWidths, firstWidth, width)
+                             : greedyBreaks(wordWidths, firstWidth, width);
+}
+
+int fillPrefixLength(const QString &text, const QString &token, FillPrefixKind *kind)
+{
+  const QChar *chars = text.constData();
+  const int size = text.size();
+  const bool cStyle = token == QLatin1String("//");
+  int i = firstNonBlank(text);
+
+  *kind = TextPrefix;
+  if (!token.isEmpty() && text.midRef(i, token.size()) == token) {
+    *kind = LineCommentPrefix;
+    i += token.size();
+    // doc comment markers such as "///" or "//!"
+    const QChar last = token.at(token.size() - 1);
+    while (i < size && (chars[i] == last || chars[i] == QLatin1Char('!')))
+      ++i;
+  } else if (cStyle && text.midRef(i, 2) == QLatin1String("/*")) {
+    *kind = BlockCommentPrefix;
+    i += 2;
+    while (i < size && (chars[i] == QLatin1Char('*') || chars[i] == QLatin1Char('!')))
+      ++i;
+  } else if (cStyle && text.midRef(i, 1) == QLatin1String("*")
+             && text.midRef(i, 2) != QLatin1String("*/")) {
+    *kind = BlockCommentPrefix;
+    ++i;
+  }
+  return skipForward(chars, size, i, BlankChars);
+}
+
+FillPrefixKind fillPrefixKind(const QString &text, const QString &token)
+{
+  FillPrefixKind kind;
+  return fillPrefixLength(text, token, &kind) == text.size() ? NoFillPrefix : kind;
+}
+
+// Prefix of the lines following a single line paragraph, a comment
+// opened by "/*" continues with " * ".
+static QString continuationPrefix(const QString &prefix, FillPrefixKind kind)
+{
+  const int indentation = firstNonBlank(prefix);
+  if (kind != BlockCommentPrefix || prefix.midRef(indentation, 2) != QLatin1String("/*"))
+    return prefix;
+  return prefix.left(indentation) + QLatin1String(" * ");
+}
+
+bool fillParagraph(const QStringList &lines, const QString &token,
+                   int fillColumn, int tabSize, FillMode mode,
+                   int *first, int *count, QStringList *replacement)
+{
+  if (lines.isEmpty())
+    return false;
+
+  FillPrefixKind kind;
+  const QString firstPrefix = lines.at(0).left(fillPrefixLength(lines.at(0), token, &kind));
+  const QString prefix = lines.size() > 1
+      ? lines.at(1).left(fillPrefixLength(lines.at(1), token, &kind))
+      : continuationPrefix(firstPrefix, kind);
+
+  // words are referred to by position, the lines stay untouched
+  struct Word { int line; int begin; int length; };
+  QVector<Word> words;
+  QVector<int> widths;
+  for (int line = 0; line < lines.size(); ++line) {
+    const QString &text = lines.at(line);
+    const QChar *chars = text.constData();
+    int i = fillPrefixLength(text, token, &kind);
+    for (;;) {
+      i = skipForward(chars, text.size(), i, BlankChars);
+      if (i == text.size())
+        break;
+      const int end = skipForward(chars, text.size(), i, NonBlankChars);
+      words.append(Word{line, i, end - i});
+      widths.append(end - i);
+      i = end;
+    }
+  }
+
+  // prefixes alone leave nothing to fill
+  if (words.isEmpty())
+    return false;
+
+  const QVector<int> breaks = breakLines(widths,
+      fillColumn - columnAt(firstPrefix, firstPrefix.size(), tabSize),
+      fillColumn - columnAt(prefix, prefix.size(), tabSize), mode);
+
+  auto buildLine = [&](int index, QString *line) {
+    *line = index == 0 ? firstPrefix : prefix;
+    const int begin = breaks.at(index);
+    const int end = index + 1 < breaks.size() ? breaks.at(index + 1) : words.size();
+    for (int w = begin; w < end; ++w) {
+      if (w > begin)
+        *line += QLatin1Char(' ');
+      const Word &word = words.at(w);
+      line->append(lines.at(word.line).constData() + word.begin, word.length);
+    }
+  };
+
+  // an already filled paragraph is only compared, never copied
+  QString line;
+  int head = 0;
+  while (head < breaks.size() && head < lines.size()) {
+    buildLine(head, &line);
+    if (line != lines.at(head))
+      break;
+    ++head;
+  }
+  if (head == breaks.size() && head == lines.size())
+    return false;
+
+  replacement->clear();
+  for (int i = head; i < breaks.size(); ++i) {
+    buildLine(i, &line);
+    replacement->append(line);
+  }
+  int tail = 0;
+  while (tail < replacement->size() && head + tail < lines.size()
+         && replacement->at(replacement->size() - 1 - tail) == lines.at(lines.size() - 1 - tail))
+    ++tail;
+  for (int i = 0; i < tail; ++i)
+    replacement->removeLast();
+
+  *first = head;
+  *count = lines.size() - head - tail;
+  return true;
+}
+
+}
+}
@@ -0,0 +1,64 @@
+/**************************************************************************
+**
+** Copyright (c) 2014 Siarhei Rachytski (siarhei.rachytski@gmail.com)
+**
+** GNU Lesser General Public License Usage
+**
+** This file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+
+#pragma once
+
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+#include <QtCore/QVector>
+
+namespace EmacsMode {
+namespace Internal {
+
+enum FillMode
+{
+  GreedyFill, // each line takes as many words as fit, linear time
+  OptimalFill // minimal raggedness over the paragraph, Knuth-Plass style
+};
+
+// Breaks words of the given widths into lines, separating words by one
+// column. The first line may be firstWidth wide, the others width. A
+// word too wide for any line gets a line of its own. Returns the index
+// of the first word of every line.
+QVector<int> breakLines(const QVector<int> &wordWidths, int firstWidth, int width, FillMode mode);
+
+enum FillPrefixKind
+{
+  NoFillPrefix,       // nothing but the prefix on the line
+  TextPrefix,         // indentation only
+  LineCommentPrefix,  // "  // ", "/// " or "# "
+  BlockCommentPrefix  // "/** " or " * ", for C style comment tokens
+};
+
+// Length of the fill prefix of text: indentation, comment start and the
+// blanks after it. token is the line comment token, empty for plain text.
+int fillPrefixLength(const QString &text, const QString &token, FillPrefixKind *kind);
+
+// Kind of the fill prefix of text, NoFillPrefix when nothing follows it.
+FillPrefixKind fillPrefixKind(const QString &text, const QString &token);
+
+// Refills the paragraph made of lines, keeping the first line's prefix
+// and using the second line's for all following lines. Returns false if
+// the paragraph is already filled or holds no words. Otherwise lines
+// [*first, *first + *count) are to be replaced by *replacement; lines
+// that come out unchanged at either end are left out. Every line holds
+// a word, so at least one line is replaced.
+bool fillParagraph(const QStringList &lines, const QString &token,
+                   int fillColumn, int tabSize, FillMode mode,
+                   int *first, int *count, QStringList *replacement);
+
+}
+}
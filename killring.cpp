@@ -5,6 +5,7 @@ KillRing::KillRing(const unsigned maxSize)
 {}
 
 void KillRing::push(QString line) {
+  ++revision_;
   killRing_.push_front(std::move(line));
   while (killRing_.size() > maxSize_) {
     killRing_.pop_back();
@@ -15,9 +16,18 @@ void KillRing::appendTop(QString line) {
   if (killRing_.empty())
       push("");
 
+  ++revision_;
   killRing_.front().append(std::move(line));
 }
 
+void KillRing::prependTop(QString line) {
+  if (killRing_.empty())
+      push("");
+
+  ++revision_;
+  killRing_.front().prepend(std::move(line));
+}
+
 QString const& KillRing::current() const {
   return killRing_.at(pos_);
 }
@@ -29,11 +39,20 @@ void KillRing::advance() {
   }
 }
 
+QStringList const& KillRing::entries() const {
+  return killRing_;
+}
+
+unsigned KillRing::revision() const {
+  return revision_;
+}
+
 bool KillRing::empty() const {
   return killRing_.empty();
 }
 
 void KillRing::clear() {
+  ++revision_;
   killRing_.clear();
 }
 
@@ -7,14 +7,19 @@ class KillRing
 private:
   QStringList killRing_;
   unsigned pos_ = 0;
+  unsigned revision_ = 0;
   const unsigned maxSize_;
 public:
   KillRing(const unsigned maxSize = 60);
   void push(QString line);
   void appendTop(QString line);
+  void prependTop(QString line);
   QString const& current() const;
   void advance();
   void clear();
   bool empty() const;
+  QStringList const& entries() const;
+  // changes whenever the contents change
+  unsigned revision() const;
 };
 
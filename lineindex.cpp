@@ -0,0 +1,108 @@
+/**************************************************************************
+**
+** Copyright (c) 2014 Siarhei Rachytski (siarhei.rachytski@gmail.com)
+**
+** GNU Lesser General Public License Usage
+**
+** This file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+
+#include "lineindex.hpp"
+
+#include <QtGui/QTextBlock>
+#include <QtGui/QTextDocument>
+
+namespace EmacsMode {
+namespace Internal {
+
+// Beyond this many blocks a fresh lookup is cheaper than walking.
+static const int MaxWalk = 16;
+
+void LineIndex::setDocument(QTextDocument *document)
+{
+  document_ = document;
+}
+
+int LineIndex::lineForPosition(int pos) const
+{
+  QTextBlock block = document_->findBlock(pos);
+  if (!block.isValid())
+    block = document_->lastBlock();
+  return block.blockNumber() + 1;
+}
+
+int LineIndex::firstPositionInLine(int line) const
+{
+  return document_->findBlockByNumber(line - 1).position();
+}
+
+int LineIndex::lastPositionInLine(int line) const
+{
+  const QTextBlock block = document_->findBlockByNumber(line - 1);
+  return block.position() + block.length() - 1;
+}
+
+QVector<int> LineIndex::linesForPositions(const QVector<int> &positions) const
+{
+  QVector<int> lines;
+  lines.reserve(positions.size());
+  QTextBlock block;
+  foreach (int pos, positions) {
+    int walked = 0;
+    while (block.isValid() && pos >= block.position() + block.length() && walked++ < MaxWalk)
+      block = block.next();
+    if (!block.isValid() || pos < block.position() || pos >= block.position() + block.length())
+      block = document_->findBlock(pos);
+    if (!block.isValid())
+      block = document_->lastBlock();
+    lines.append(block.blockNumber() + 1);
+  }
+  return lines;
+}
+
+void LineIndex::linesForPositions(int first, int second, int *firstLine, int *secondLine) const
+{
+  QTextBlock block = document_->findBlock(first);
+  if (!block.isValid())
+    block = document_->lastBlock();
+  *firstLine = block.blockNumber() + 1;
+
+  int walked = 0;
+  while (block.isValid() && second >= block.position() + block.length() && walked++ < MaxWalk)
+    block = block.next();
+  while (block.isValid() && second < block.position() && walked++ < MaxWalk)
+    block = block.previous();
+  if (!block.isValid() || second < block.position() || second >= block.position() + block.length())
+    block = document_->findBlock(second);
+  if (!block.isValid())
+    block = document_->lastBlock();
+  *secondLine = block.blockNumber() + 1;
+}
+
+QVector<int> LineIndex::firstPositionsInLines(const QVector<int> &lines) const
+{
+  QVector<int> positions;
+  positions.reserve(lines.size());
+  QTextBlock block;
+  foreach (int line, lines) {
+    const int number = line - 1;
+    if (block.isValid() && number >= block.blockNumber() && number - block.blockNumber() <= MaxWalk) {
+      while (block.isValid() && block.blockNumber() < number)
+        block = block.next();
+    } else {
+      block = document_->findBlockByNumber(number);
+    }
+    positions.append(block.position());
+  }
+  return positions;
+}
+
+}
+}
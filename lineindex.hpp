@@ -0,0 +1,51 @@
+/**************************************************************************
+**
+** Copyright (c) 2014 Siarhei Rachytski (siarhei.rachytski@gmail.com)
+**
+** GNU Lesser General Public License Usage
+**
+** This file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+
+#pragma once
+
+#include <QtCore/QVector>
+
+class QTextDocument;
+
+namespace EmacsMode {
+namespace Internal {
+
+// Conversions between positions and line numbers that go straight
+// through the document's block map, without QTextCursor copies.
+// 1 based lines, 0 based positions, like the rest of the handler.
+class LineIndex
+{
+public:
+  void setDocument(QTextDocument *document);
+
+  int lineForPosition(int pos) const;
+  int firstPositionInLine(int line) const;
+  int lastPositionInLine(int line) const;
+
+  // Batched variants, positions or lines that are close to the previous
+  // one are reached by walking blocks instead of a new lookup.
+  QVector<int> linesForPositions(const QVector<int> &positions) const;
+  // The usual pair, such as a region's anchor and position, without a
+  // vector to hold it.
+  void linesForPositions(int first, int second, int *firstLine, int *secondLine) const;
+  QVector<int> firstPositionsInLines(const QVector<int> &lines) const;
+
+private:
+  QTextDocument *document_ = nullptr;
+};
+
+}
+}
@@ -31,7 +31,7 @@ MiniBuffer::MiniBuffer()
 
   hideTimer_.setSingleShot(true);
   hideTimer_.setInterval(8000);
-  connect(&hideTimer_, SIGNAL(timeout()), SLOT(hide()));
+  connect(&hideTimer_, SIGNAL(timeout()), SLOT(hideMessage()));
 }
 
 void MiniBuffer::setContents(const QString &contents, int messageLevel)
@@ -43,24 +43,8 @@ void MiniBuffer::setContents(const QString &contents, int messageLevel)
   else
   {
     hideTimer_.stop();
-    show();
-
-    label_->setText(contents);
-
-    QString css;
-    if (messageLevel == MessageError)
-    {
-      css = QLatin1String("border:1px solid rgba(255,255,255,150);"
-                          "background-color:rgba(255,0,0,100);");
-    } else if (messageLevel == MessageWarning) {
-      css = QLatin1String("border:1px solid rgba(255,255,255,120);"
-                          "background-color:rgba(255,255,0,20);");
-    } else if (messageLevel == MessageShowCmd) {
-      css = QLatin1String("border:1px solid rgba(255,255,255,120);"
-                          "background-color:rgba(100,255,100,30);");
-    }
-    label_->setStyleSheet(QString::fromLatin1(
-                             "*{border-radius:2px;padding-left:4px;padding-right:4px;%1}").arg(css));
+    showingMessage_ = true;
+    showText(contents, messageLevel);
   }
 
   setCurrentWidget(label_);
@@ -68,6 +52,44 @@ void MiniBuffer::setContents(const QString &contents, int messageLevel)
   lastMessageLevel_ = messageLevel;
 }
 
+void MiniBuffer::setIndicator(const QString &indicator)
+{
+  indicator_ = indicator;
+  if (!showingMessage_)
+    hideMessage();
+}
+
+void MiniBuffer::hideMessage()
+{
+  showingMessage_ = false;
+  if (indicator_.isEmpty())
+    hide();
+  else
+    showText(indicator_, MessageWarning);
+}
+
+void MiniBuffer::showText(const QString &text, int messageLevel)
+{
+  show();
+
+  label_->setText(text);
+
+  QString css;
+  if (messageLevel == MessageError)
+  {
+    css = QLatin1String("border:1px solid rgba(255,255,255,150);"
+                        "background-color:rgba(255,0,0,100);");
+  } else if (messageLevel == MessageWarning) {
+    css = QLatin1String("border:1px solid rgba(255,255,255,120);"
+                        "background-color:rgba(255,255,0,20);");
+  } else if (messageLevel == MessageShowCmd) {
+    css = QLatin1String("border:1px solid rgba(255,255,255,120);"
+                        "background-color:rgba(100,255,100,30);");
+  }
+  label_->setStyleSheet(QString::fromLatin1(
+                           "*{border-radius:2px;padding-left:4px;padding-right:4px;%1}").arg(css));
+}
+
 QSize MiniBuffer::sizeHint() const
 {
   QSize size = QWidget::sizeHint();
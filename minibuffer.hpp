@@ -35,13 +35,22 @@ public:
   MiniBuffer();
 
   void setContents(const QString &contents, int messageLevel);
+  // Shown instead of hiding while there is no message, until cleared.
+  void setIndicator(const QString &indicator);
 
   QSize sizeHint() const;
 
+private slots:
+  void hideMessage();
+
 private:
+  void showText(const QString &text, int messageLevel);
+
   QLabel *label_;
   QTimer hideTimer_;
   int lastMessageLevel_;
+  QString indicator_;
+  bool showingMessage_ = false;
 };
 
 }
@@ -4,6 +4,7 @@
 #include <QString>
 
 #include "killring.hpp"
+#include "symboldictionary.hpp"
 
 namespace EmacsMode {
 namespace Internal {
@@ -31,6 +32,11 @@ struct PluginState
   QString currentCommand_;
 
   KillRing killRing_;
+  QString killedRectangle_; // rows, each ending in a newline
+
+  SymbolDictionary symbols_;
+  unsigned killRingSymbolsRevision_ = 0; // kill ring revision in symbols_
+  QStringList fileNameHistory_;          // most recent first
 };
 
 }
@@ -0,0 +1,90 @@
+/**************************************************************************
+**
+** Copyright (c) 2014 Siarhei Rachytski (siarhei.rachytski@gmail.com)
+**
+** GNU Lesser General Public License Usage
+**
+** This file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+
+#include "rectangle.hpp"
+#include "textscan.hpp"
+
+namespace EmacsMode {
+namespace Internal {
+
+static inline void appendSpaces(QString *out, int count)
+{
+  if (count > 0)
+    out->resize(out->size() + count, QLatin1Char(' '));
+}
+
+RectangleSpan rectangleSpan(const QString &text, int beginColumn, int endColumn, int tabSize)
+{
+  RectangleSpan span;
+  span.begin_ = indexAtColumn(text, beginColumn, tabSize);
+  span.beginColumn_ = columnAt(text, span.begin_, tabSize);
+  if (span.beginColumn_ > beginColumn) {
+    // the preceding tab covers the left edge
+    --span.begin_;
+    span.beginColumn_ = columnAt(text, span.begin_, tabSize);
+  }
+  span.end_ = qMax(indexAtColumn(text, endColumn, tabSize), span.begin_);
+  span.endColumn_ = columnAt(text, span.end_, tabSize);
+  return span;
+}
+
+void appendRectangleRow(QString *out, const QString &text,
+                        int beginColumn, int endColumn, int tabSize)
+{
+  const RectangleSpan span = rectangleSpan(text, beginColumn, endColumn, tabSize);
+
+  // columns of the rectangle filled so far
+  int filled = 0;
+  int first = span.begin_;
+  int firstColumn = span.beginColumn_;
+  if (span.beginColumn_ < beginColumn && span.begin_ < text.size()) {
+    ++first;
+    firstColumn = columnAt(text, first, tabSize);
+    filled = qMin(firstColumn, endColumn) - beginColumn;
+    appendSpaces(out, filled);
+  }
+
+  int last = span.end_;
+  int lastColumn = span.endColumn_;
+  if (span.endColumn_ > endColumn && last > first) {
+    --last;
+    lastColumn = columnAt(text, last, tabSize);
+  }
+
+  if (last > first) {
+    out->append(text.constData() + first, last - first);
+    filled += lastColumn - firstColumn;
+  }
+  appendSpaces(out, endColumn - beginColumn - filled);
+}
+
+QString rectangleReplacement(const RectangleSpan &span, int textSize,
+                             int beginColumn, int endColumn, const QString &contents)
+{
+  QString result;
+  if (span.end_ == textSize && isBlank(contents))
+    return result;
+
+  result.reserve(contents.size() + qMax(beginColumn - span.beginColumn_, 0)
+                 + qMax(span.endColumn_ - endColumn, 0));
+  appendSpaces(&result, beginColumn - span.beginColumn_);
+  result += contents;
+  appendSpaces(&result, span.endColumn_ - endColumn);
+  return result;
+}
+
+}
+}
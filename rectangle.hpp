@@ -0,0 +1,50 @@
+/**************************************************************************
+**
+** Copyright (c) 2014 Siarhei Rachytski (siarhei.rachytski@gmail.com)
+**
+** GNU Lesser General Public License Usage
+**
+** This file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+
+#pragma once
+
+#include <QtCore/QString>
+
+namespace EmacsMode {
+namespace Internal {
+
+// Where the columns [beginColumn, endColumn) of a rectangle fall in one
+// line's text. Tabs advance to the next multiple of the tab size. A tab
+// straddling either edge belongs to the span and is turned into spaces
+// when the span is replaced.
+struct RectangleSpan
+{
+  int begin_;       // first index of the span
+  int end_;         // index after the span
+  int beginColumn_; // column of begin_, left of the rectangle if a tab is split or the line is short
+  int endColumn_;   // column of end_, right of the rectangle if a tab is split
+};
+
+RectangleSpan rectangleSpan(const QString &text, int beginColumn, int endColumn, int tabSize);
+
+// Appends the part of text inside the rectangle to out, padded with
+// spaces to endColumn - beginColumn columns.
+void appendRectangleRow(QString *out, const QString &text,
+                        int beginColumn, int endColumn, int tabSize);
+
+// Text that replaces span so that contents takes the rectangle's place
+// and everything right of it keeps its column. Nothing is padded when
+// the line ends inside the rectangle and contents is blank.
+QString rectangleReplacement(const RectangleSpan &span, int textSize,
+                             int beginColumn, int endColumn, const QString &contents);
+
+}
+}
@@ -0,0 +1,147 @@
+/**************************************************************************
+**
+** Copyright (c) 2014 Siarhei Rachytski (siarhei.rachytski@gmail.com)
+**
+** GNU Lesser General Public License Usage
+**
+** This file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+
+#include "shellcommand.hpp"
+
+#include <QtGui/QTextBlock>
+#include <QtGui/QTextDocument>
+
+namespace EmacsMode {
+namespace Internal {
+
+// Bytes encoded per write, and the most left unwritten in the pipe
+// before waiting for the process to catch up.
+static const int InputChunkSize = 64 * 1024;
+static const int MaxPendingInput = 4 * InputChunkSize;
+
+ShellCommand::ShellCommand(QTextDocument *document, int begin, int end,
+                           const QString &command, QObject *parent)
+  : QObject(parent)
+  , command_(command)
+  , begin_(document)
+  , end_(document)
+  , input_(document)
+{
+  begin_.setPosition(begin);
+  end_.setPosition(end);
+  input_.setPosition(begin);
+  chunk_.reserve(InputChunkSize + 1024);
+
+  connect(&process_, SIGNAL(started()), SLOT(writeInput()));
+  connect(&process_, SIGNAL(bytesWritten(qint64)), SLOT(writeInput()));
+  connect(&process_, SIGNAL(readyReadStandardOutput()), SLOT(readOutput()));
+  connect(&process_, SIGNAL(finished(int,QProcess::ExitStatus)),
+          SLOT(onFinished(int,QProcess::ExitStatus)));
+  connect(&process_, SIGNAL(errorOccurred(QProcess::ProcessError)),
+          SLOT(onError(QProcess::ProcessError)));
+}
+
+void ShellCommand::start()
+{
+#ifdef Q_OS_WIN
+  process_.start(QLatin1String("cmd.exe"), QStringList() << QLatin1String("/c") << command_);
+#else
+  process_.start(QLatin1String("/bin/sh"), QStringList() << QLatin1String("-c") << command_);
+#endif
+}
+
+void ShellCommand::cancel()
+{
+  cancelled_ = true;
+  process_.kill();
+}
+
+int ShellCommand::begin() const
+{
+  return begin_.position();
+}
+
+int ShellCommand::end() const
+{
+  return end_.position();
+}
+
+QString ShellCommand::command() const
+{
+  return command_;
+}
+
+void ShellCommand::writeInput()
+{
+  if (process_.state() != QProcess::Running || inputClosed_)
+    return;
+
+  QTextDocument *document = input_.document();
+  while (process_.bytesToWrite() < MaxPendingInput && input_.position() < end_.position()) {
+    chunk_.resize(0);
+    int pos = input_.position();
+    const int end = end_.position();
+    for (QTextBlock block = document->findBlock(pos);
+         block.isValid() && pos < end && chunk_.size() < InputChunkSize; block = block.next()) {
+      const int blockEnd = block.position() + block.length() - 1;
+      const int stop = qMin(blockEnd, end);
+      chunk_ += block.text().midRef(pos - block.position(), stop - pos).toLocal8Bit();
+      if (stop == blockEnd && stop < end) {
+        chunk_ += '\n';
+        pos = stop + 1;
+      } else {
+        pos = stop;
+      }
+    }
+    input_.setPosition(pos);
+    process_.write(chunk_);
+  }
+
+  // the pipe is closed once the queued input is written
+  if (input_.position() >= end_.position()) {
+    inputClosed_ = true;
+    process_.closeWriteChannel();
+  }
+}
+
+void ShellCommand::readOutput()
+{
+  output_ += process_.readAllStandardOutput();
+}
+
+void ShellCommand::onFinished(int exitCode, QProcess::ExitStatus exitStatus)
+{
+  readOutput();
+  if (cancelled_)
+    finish(-1, tr("Shell command killed"));
+  else if (exitStatus == QProcess::CrashExit)
+    finish(-1, tr("Shell command crashed"));
+  else
+    finish(exitCode, QString::fromLocal8Bit(process_.readAllStandardError()));
+}
+
+void ShellCommand::onError(QProcess::ProcessError error)
+{
+  // a crash or kill is reported by finished() as well
+  if (error == QProcess::FailedToStart)
+    finish(-1, process_.errorString());
+}
+
+void ShellCommand::finish(int exitCode, const QString &errors)
+{
+  if (done_)
+    return;
+  done_ = true;
+  emit finished(exitCode, QString::fromLocal8Bit(output_), errors);
+}
+
+}
+}
@@ -0,0 +1,75 @@
+/**************************************************************************
+**
+** Copyright (c) 2014 Siarhei Rachytski (siarhei.rachytski@gmail.com)
+**
+** GNU Lesser General Public License Usage
+**
+** This file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+
+#pragma once
+
+#include <QtCore/QByteArray>
+#include <QtCore/QObject>
+#include <QtCore/QProcess>
+#include <QtGui/QTextCursor>
+
+class QTextDocument;
+
+namespace EmacsMode {
+namespace Internal {
+
+// Pipes a range of a document through a shell command. The range is
+// encoded and written a few blocks at a time whenever the pipe has
+// drained, so it is never copied as a whole, and the output is
+// collected as it arrives. Nothing waits on the process.
+class ShellCommand : public QObject
+{
+  Q_OBJECT
+
+public:
+  ShellCommand(QTextDocument *document, int begin, int end,
+               const QString &command, QObject *parent = 0);
+
+  void start();
+  void cancel();
+
+  // the range as moved by edits made while the command runs
+  int begin() const;
+  int end() const;
+  QString command() const;
+
+signals:
+  // exitCode is -1 if the command could not run or was cancelled
+  void finished(int exitCode, const QString &output, const QString &errors);
+
+private slots:
+  void writeInput();
+  void readOutput();
+  void onFinished(int exitCode, QProcess::ExitStatus exitStatus);
+  void onError(QProcess::ProcessError error);
+
+private:
+  void finish(int exitCode, const QString &errors);
+
+  QProcess process_;
+  QString command_;
+  QTextCursor begin_;
+  QTextCursor end_;
+  QTextCursor input_; // next position to write
+  QByteArray chunk_;  // reused for every write
+  QByteArray output_;
+  bool inputClosed_ = false;
+  bool done_ = false;
+  bool cancelled_ = false;
+};
+
+}
+}
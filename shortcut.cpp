@@ -17,36 +17,45 @@
 #include <QString>
 #include <QStringList>
 
+#include <algorithm>
+
 namespace EmacsMode
 {
 
-Shortcut::Shortcut(Qt::KeyboardModifiers mods, std::vector<int> keys, Action action)
-  : mods_(mods), keys_(std::move(keys)), action_(action)
+Shortcut::Shortcut(std::vector<Qt::KeyboardModifiers> mods, std::vector<int> keys, Action action)
+  : mods_(std::move(mods)), keys_(std::move(keys)), action_(action)
 {}
 
 Shortcut::Shortcut(char const * s, Action action)
     : action_(std::move(action))
 {
-  QStringList l = QString::fromLatin1(s).split(QString::fromLocal8Bit("|"));
-  QString keys = l.at(l.size() - 1).toLower();
+  foreach (QString const & chord, QString::fromLatin1(s).split(QLatin1Char(' '), QString::SkipEmptyParts))
+    parseChord(chord);
+}
+
+void Shortcut::parseChord(QString const & chord)
+{
+  QStringList l = chord.split(QString::fromLocal8Bit("|"));
+  Qt::KeyboardModifiers mods;
+  size_t firstKey = keys_.size();
 
   for (int i = 0; i < l.size(); ++i)
   {
     QString key = l.at(i).toUpper();
     if (key == QString::fromLocal8Bit("<CONTROL>"))
-      mods_ |= Qt::ControlModifier;
+      mods |= Qt::ControlModifier;
     else if (key == QString::fromLocal8Bit("<META>"))
     {
 #if defined(Q_OS_WIN) || defined(Q_OS_LINUX)
-      mods_ |= Qt::ControlModifier;
+      mods |= Qt::ControlModifier;
 #else
-      mods_ |= Qt::MetaModifier;
+      mods |= Qt::MetaModifier;
 #endif
     }
     else if (key == QString::fromLocal8Bit("<SHIFT>"))
-      mods_ |= Qt::ShiftModifier;
+      mods |= Qt::ShiftModifier;
     else if (key == QString::fromLocal8Bit("<ALT>"))
-      mods_ |= Qt::AltModifier;
+      mods |= Qt::AltModifier;
     else if (key == QString::fromLocal8Bit("<TAB>"))
       keys_.push_back(Qt::Key_Tab);
     else if (key == QString::fromLocal8Bit("<SPACE>"))
@@ -57,9 +66,20 @@ Shortcut::Shortcut(char const * s, Action action)
       keys_.push_back(Qt::Key_Escape);
     else if (key == QString::fromLocal8Bit("<SLASH>"))
       keys_.push_back(Qt::Key_Slash);
+    else if (key == QString::fromLocal8Bit("<BACKSPACE>"))
+      keys_.push_back(Qt::Key_Backspace);
+    else if (key == QString::fromLocal8Bit("<BRACELEFT>"))
+      keys_.push_back(Qt::Key_BraceLeft);
+    else if (key == QString::fromLocal8Bit("<BRACERIGHT>"))
+      keys_.push_back(Qt::Key_BraceRight);
+    else if (key == QString::fromLocal8Bit("<BAR>"))
+      keys_.push_back(Qt::Key_Bar);
     else
       keys_.push_back(key.at(0).toLatin1() - 'A' + Qt::Key_A);
   }
+
+  mods_.resize(keys_.size(), Qt::NoModifier);
+  std::fill(mods_.begin() + firstKey, mods_.end(), mods);
 }
 
 Shortcut::Shortcut()
@@ -75,7 +95,7 @@ bool Shortcut::isAccepted(QKeyEvent * kev) const
 {
   int key = kev->key();
   Qt::KeyboardModifiers mods = kev->modifiers();
-  return ((mods == mods_) && (key == keys_.front()));
+  return (!keys_.empty() && (mods == mods_.front()) && (key == keys_.front()));
 }
 
 bool Shortcut::hasFollower(QKeyEvent * kev) const
@@ -87,13 +107,17 @@ Shortcut const Shortcut::getFollower(QKeyEvent * kev) const
 {
   if (hasFollower(kev))
   {
-    std::vector<int> keys;
-    std::copy(++keys_.begin(), keys_.end(), std::back_inserter(keys));
-    return Shortcut(mods_, std::move(keys), action_);
+    std::vector<int> keys(++keys_.begin(), keys_.end());
+    std::vector<Qt::KeyboardModifiers> mods(++mods_.begin(), mods_.end());
+    return Shortcut(std::move(mods), std::move(keys), action_);
   }
   return Shortcut();
 }
 
+Action Shortcut::action() const {
+  return action_;
+}
+
 Action::Id Shortcut::actionId() const {
   return action_.id();
 }
@@ -23,11 +23,14 @@
 namespace EmacsMode
 {
 
+// Key sequence bound to an action. "<META>|x|s" applies the modifiers to
+// every key (C-x C-s), chords separated by spaces carry their own
+// modifiers: "<META>|x r|k" is C-x r k.
 class Shortcut
 {
 private:
 
-  Qt::KeyboardModifiers mods_;
+  std::vector<Qt::KeyboardModifiers> mods_; // one per key
   std::vector<int> keys_;
   Action action_;
 
@@ -35,14 +38,18 @@ public:
 
   Shortcut();
   Shortcut(char const * s, Action action);
-  Shortcut(Qt::KeyboardModifiers, std::vector<int> keys, Action action);
+  Shortcut(std::vector<Qt::KeyboardModifiers> mods, std::vector<int> keys, Action action);
 
   void exec() const;
 
+  Action action() const;
   Action::Id actionId() const;
   bool isEmpty() const;
   bool isAccepted(QKeyEvent * kev) const;
   bool hasFollower(QKeyEvent * kev) const;
   Shortcut const getFollower(QKeyEvent * kev) const;
+
+private:
+  void parseChord(QString const & chord);
 };
 }
@@ -0,0 +1,185 @@
+/**************************************************************************
+**
+** Copyright (c) 2014 Siarhei Rachytski (siarhei.rachytski@gmail.com)
+**
+** GNU Lesser General Public License Usage
+**
+** This file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+
+#include "sortlines.hpp"
+#include "textscan.hpp"
+
+#include <QtCore/QPair>
+#include <QtCore/QSet>
+#include <QtCore/QStringRef>
+#include <QtCore/QThread>
+#include <QtConcurrent/QtConcurrentMap>
+
+#include <algorithm>
+
+namespace EmacsMode {
+namespace Internal {
+
+// Fewer lines are sorted on the calling thread.
+static const int ParallelSortThreshold = 65536;
+
+QVector<LineSpan> splitLines(const QString &text)
+{
+  QVector<LineSpan> lines;
+  const QChar *chars = text.constData();
+  int begin = 0;
+  for (;;) {
+    const int end = findForward(chars, text.size(), begin, QLatin1Char('\n'));
+    if (end == -1)
+      break;
+    lines.append(LineSpan{begin, end - begin});
+    begin = end + 1;
+  }
+  lines.append(LineSpan{begin, text.size() - begin});
+  return lines;
+}
+
+// Value of the first number on the line, 0 without one.
+static double numericKey(const QString &text, const LineSpan &line)
+{
+  const QChar *chars = text.constData() + line.begin_;
+  int i = 0;
+  while (i < line.length_ && !chars[i].isDigit())
+    ++i;
+  if (i == line.length_)
+    return 0;
+  const bool negative = i > 0 && chars[i - 1] == QLatin1Char('-');
+  double value = 0;
+  for (; i < line.length_ && chars[i].isDigit(); ++i)
+    value = value * 10 + chars[i].digitValue();
+  if (i + 1 < line.length_ && chars[i] == QLatin1Char('.') && chars[i + 1].isDigit()) {
+    double scale = 1;
+    for (++i; i < line.length_ && chars[i].isDigit(); ++i) {
+      scale /= 10;
+      value += chars[i].digitValue() * scale;
+    }
+  }
+  return negative ? -value : value;
+}
+
+template <typename T, typename Less>
+static void stableSort(QVector<T> *items, Less less)
+{
+  T *data = items->data();
+  const int count = items->size();
+  const int threads = QThread::idealThreadCount();
+  if (count < ParallelSortThreshold || threads < 2) {
+    std::stable_sort(data, data + count, less);
+    return;
+  }
+
+  typedef QPair<int, int> Chunk; // [first, second)
+  QVector<Chunk> chunks;
+  for (int i = 0; i < threads; ++i)
+    chunks.append(Chunk(qint64(count) * i / threads, qint64(count) * (i + 1) / threads));
+  QtConcurrent::blockingMap(chunks, [data, less](const Chunk &chunk) {
+    std::stable_sort(data + chunk.first, data + chunk.second, less);
+  });
+
+  // merge neighbours, a level at a time
+  while (chunks.size() > 1) {
+    QVector<Chunk> merged;
+    QVector<QPair<Chunk, Chunk> > pairs;
+    for (int i = 0; i + 1 < chunks.size(); i += 2) {
+      pairs.append(qMakePair(chunks.at(i), chunks.at(i + 1)));
+      merged.append(Chunk(chunks.at(i).first, chunks.at(i + 1).second));
+    }
+    if (chunks.size() % 2)
+      merged.append(chunks.last());
+    QtConcurrent::blockingMap(pairs, [data, less](const QPair<Chunk, Chunk> &pair) {
+      std::inplace_merge(data + pair.first.first, data + pair.second.first,
+                         data + pair.second.second, less);
+    });
+    chunks = merged;
+  }
+}
+
+void sortLines(const QString &text, QVector<LineSpan> *lines, bool numeric, bool descending)
+{
+  if (!numeric) {
+    stableSort(lines, [&text, descending](const LineSpan &a, const LineSpan &b) {
+      const int result = text.midRef(a.begin_, a.length_).compare(text.midRef(b.begin_, b.length_));
+      return descending ? result > 0 : result < 0;
+    });
+    return;
+  }
+
+  // the keys are parsed once, not on every comparison
+  typedef QPair<double, LineSpan> Keyed;
+  QVector<Keyed> keyed;
+  keyed.reserve(lines->size());
+  for (const LineSpan &line : *lines)
+    keyed.append(Keyed(numericKey(text, line), line));
+  stableSort(&keyed, [descending](const Keyed &a, const Keyed &b) {
+    return descending ? a.first > b.first : a.first < b.first;
+  });
+  for (int i = 0; i < keyed.size(); ++i)
+    (*lines)[i] = keyed.at(i).second;
+}
+
+int deleteDuplicateLines(const QString &text, QVector<LineSpan> *lines, bool keepLast)
+{
+  QSet<QStringRef> seen;
+  seen.reserve(lines->size());
+  QVector<LineSpan> kept;
+  kept.reserve(lines->size());
+  const int count = lines->size();
+  for (int i = 0; i < count; ++i) {
+    const LineSpan &line = lines->at(keepLast ? count - 1 - i : i);
+    const int before = seen.size();
+    seen.insert(text.midRef(line.begin_, line.length_));
+    if (seen.size() != before)
+      kept.append(line);
+  }
+  if (keepLast)
+    std::reverse(kept.begin(), kept.end());
+  const int dropped = count - kept.size();
+  lines->swap(kept);
+  return dropped;
+}
+
+bool sameLines(const QString &text, const QVector<LineSpan> &a, const QVector<LineSpan> &b)
+{
+  if (a.size() != b.size())
+    return false;
+  for (int i = 0; i < a.size(); ++i) {
+    const LineSpan &x = a.at(i);
+    const LineSpan &y = b.at(i);
+    if (x.begin_ == y.begin_ && x.length_ == y.length_)
+      continue;
+    if (text.midRef(x.begin_, x.length_) != text.midRef(y.begin_, y.length_))
+      return false;
+  }
+  return true;
+}
+
+QString joinLines(const QString &text, const QVector<LineSpan> &lines)
+{
+  int size = lines.size() - 1;
+  for (const LineSpan &line : lines)
+    size += line.length_;
+  QString joined;
+  joined.reserve(qMax(size, 0));
+  for (int i = 0; i < lines.size(); ++i) {
+    if (i > 0)
+      joined += QLatin1Char('\n');
+    joined.append(text.constData() + lines.at(i).begin_, lines.at(i).length_);
+  }
+  return joined;
+}
+
+}
+}
@@ -0,0 +1,52 @@
+/**************************************************************************
+**
+** Copyright (c) 2014 Siarhei Rachytski (siarhei.rachytski@gmail.com)
+**
+** GNU Lesser General Public License Usage
+**
+** This file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+
+#pragma once
+
+#include <QtCore/QString>
+#include <QtCore/QVector>
+
+namespace EmacsMode {
+namespace Internal {
+
+// A line of a flat buffer holding lines separated by '\n'.
+struct LineSpan
+{
+  int begin_;
+  int length_;
+};
+
+QVector<LineSpan> splitLines(const QString &text);
+
+// Sorts lines by their text, or by the first number on each line. The
+// sort is stable, in descending order it keeps equal lines in order too.
+// Large inputs are sorted in chunks on the global thread pool and then
+// merged.
+void sortLines(const QString &text, QVector<LineSpan> *lines, bool numeric, bool descending);
+
+// Drops every line equal to an earlier one, or to a later one when
+// keepLast is set. Returns the number of lines dropped.
+int deleteDuplicateLines(const QString &text, QVector<LineSpan> *lines, bool keepLast);
+
+// Whether both lists hold the same lines of text in the same order.
+// Spans that did not move are not compared.
+bool sameLines(const QString &text, const QVector<LineSpan> &a, const QVector<LineSpan> &b);
+
+// The lines separated by '\n', in one allocation.
+QString joinLines(const QString &text, const QVector<LineSpan> &lines);
+
+}
+}
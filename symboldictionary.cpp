@@ -0,0 +1,119 @@
+/**************************************************************************
+**
+** Copyright (c) 2014 Siarhei Rachytski (siarhei.rachytski@gmail.com)
+**
+** GNU Lesser General Public License Usage
+**
+** This file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+
+#include "symboldictionary.hpp"
+
+#include <QtCore/QSet>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace EmacsMode {
+namespace Internal {
+
+// Number of touches after which a word's frequency counts half.
+static const double RecencyHalfLife = 256.0;
+
+QString SymbolDictionary::ref(const QString &word)
+{
+  auto it = entries_.find(word);
+  if (it == entries_.end()) {
+    it = entries_.insert(QString(word.constData(), word.size()), Entry());
+    it->lastUse_ = clock_;
+  }
+  ++it->refs_;
+  return it.key();
+}
+
+void SymbolDictionary::unref(const QString &word, int occurrences)
+{
+  auto it = entries_.find(word);
+  if (it == entries_.end())
+    return;
+  it->occurrences_ -= occurrences;
+  if (--it->refs_ <= 0)
+    entries_.erase(it);
+}
+
+void SymbolDictionary::addOccurrences(const QString &word, int count)
+{
+  auto it = entries_.find(word);
+  if (it != entries_.end())
+    it->occurrences_ += count;
+}
+
+void SymbolDictionary::touch(const QString &word)
+{
+  auto it = entries_.find(word);
+  if (it != entries_.end()) {
+    ++it->uses_;
+    it->lastUse_ = ++clock_;
+  }
+}
+
+void SymbolDictionary::setSourceWords(Source source, const QStringList &words)
+{
+  const QStringList unique = words.toSet().toList();
+
+  // ref the new set first so words present in both survive
+  QStringList &current = sources_[source];
+  QStringList old;
+  old.swap(current);
+  foreach (const QString &word, unique)
+    current.append(ref(word));
+  foreach (const QString &word, old)
+    unref(word);
+}
+
+QStringList SymbolDictionary::completions(const QString &prefix, int maxCount) const
+{
+  struct Candidate
+  {
+    double score_;
+    int frequency_;
+    QString word_;
+  };
+
+  std::vector<Candidate> ranked;
+  for (auto it = entries_.lowerBound(prefix); it != entries_.end() && it.key().startsWith(prefix); ++it) {
+    if (it.key().size() == prefix.size())
+      continue;
+    const Entry &entry = it.value();
+    const double age = clock_ - entry.lastUse_;
+    // words of the kill ring or the file-name history occur once
+    const int frequency = qMax(entry.occurrences_, 1) + entry.uses_;
+    ranked.push_back({frequency * std::exp2(-age / RecencyHalfLife), frequency, it.key()});
+  }
+
+  const auto last = ranked.begin() + qMin<int>(maxCount, int(ranked.size()));
+  std::partial_sort(ranked.begin(), last, ranked.end(),
+                    [](const Candidate &a, const Candidate &b) {
+                      if (a.score_ != b.score_)
+                        return a.score_ > b.score_;
+                      if (a.frequency_ != b.frequency_)
+                        return a.frequency_ > b.frequency_;
+                      return a.word_ < b.word_;
+                    });
+
+  QStringList result;
+  for (auto it = ranked.begin(); it != last; ++it)
+    result.append(it->word_);
+  return result;
+}
+
+}
+}
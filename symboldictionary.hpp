@@ -0,0 +1,71 @@
+/**************************************************************************
+**
+** Copyright (c) 2014 Siarhei Rachytski (siarhei.rachytski@gmail.com)
+**
+** GNU Lesser General Public License Usage
+**
+** This file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+
+#pragma once
+
+#include <QtCore/QHash>
+#include <QtCore/QMap>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+
+namespace EmacsMode {
+namespace Internal {
+
+// Words known to the plugin as a whole: every indexed buffer, the kill
+// ring and the file-name history.
+//
+// Each word is stored once and shared (QString is implicitly shared)
+// with the per-buffer WordIndex instances, which hold one reference per
+// word they contain. Dropping a buffer therefore costs one unref per
+// distinct word in it. The indexes also report how often each word
+// occurs in them, which is what completions are ranked by.
+class SymbolDictionary
+{
+public:
+  enum Source
+  {
+    KillRingSource,
+    FileNameSource
+  };
+
+  // Returns the shared copy of word.
+  QString ref(const QString &word);
+  // Drops a reference along with the occurrences it reported.
+  void unref(const QString &word, int occurrences = 0);
+  void addOccurrences(const QString &word, int count);
+  // Marks word as just used, for ranking.
+  void touch(const QString &word);
+  void setSourceWords(Source source, const QStringList &words);
+
+  // Words longer than prefix starting with it, best ranked first.
+  QStringList completions(const QString &prefix, int maxCount = 64) const;
+
+private:
+  struct Entry
+  {
+    int refs_ = 0;
+    int occurrences_ = 0;
+    int uses_ = 0;
+    quint32 lastUse_ = 0;
+  };
+
+  QMap<QString, Entry> entries_;
+  QHash<int, QStringList> sources_;
+  quint32 clock_ = 0;
+};
+
+}
+}
@@ -0,0 +1,249 @@
+/**************************************************************************
+**
+** Copyright (c) 2014 Siarhei Rachytski (siarhei.rachytski@gmail.com)
+**
+** GNU Lesser General Public License Usage
+**
+** This file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+
+#include "textscan.hpp"
+
+#include <QtCore/qalgorithms.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  define EMACSMODE_SSE2
+#  include <emmintrin.h>
+#endif
+
+namespace EmacsMode {
+namespace Internal {
+
+bool isWordChar(QChar c)
+{
+  const ushort u = c.unicode();
+  if (u < 0x80)
+    return (u >= 'a' && u <= 'z') || (u >= 'A' && u <= 'Z') || (u >= '0' && u <= '9') || u == '_';
+  return c.isLetterOrNumber();
+}
+
+bool isBlankChar(QChar c)
+{
+  const ushort u = c.unicode();
+  if (u < 0x80)
+    return u == ' ' || (u >= '\t' && u <= '\r');
+  return c.isSpace();
+}
+
+bool isInClass(QChar c, CharClass charClass)
+{
+  switch (charClass) {
+  case WordChars:
+    return isWordChar(c);
+  case NonWordChars:
+    return !isWordChar(c);
+  case BlankChars:
+    return isBlankChar(c);
+  case NonBlankChars:
+    return !isBlankChar(c);
+  }
+  return false;
+}
+
+#ifdef EMACSMODE_SSE2
+
+static const int ChunkSize = 8;
+
+// Loads eight characters, returns false if any of them is not ASCII.
+static inline bool loadAscii(const QChar *chars, __m128i *v)
+{
+  *v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(chars));
+  const __m128i high = _mm_and_si128(*v, _mm_set1_epi16(short(0xff80)));
+  return _mm_movemask_epi8(_mm_cmpeq_epi16(high, _mm_setzero_si128())) == 0xffff;
+}
+
+static inline __m128i inRange(__m128i v, char lo, char hi)
+{
+  return _mm_and_si128(_mm_cmpgt_epi16(v, _mm_set1_epi16(lo - 1)),
+                       _mm_cmplt_epi16(v, _mm_set1_epi16(hi + 1)));
+}
+
+// Two bits per character, set for characters in charClass.
+static inline int classMask(__m128i v, CharClass charClass)
+{
+  __m128i matches;
+  if (charClass == WordChars || charClass == NonWordChars) {
+    const __m128i lower = _mm_or_si128(v, _mm_set1_epi16(0x20));
+    matches = _mm_or_si128(_mm_or_si128(inRange(lower, 'a', 'z'), inRange(v, '0', '9')),
+                           _mm_cmpeq_epi16(v, _mm_set1_epi16('_')));
+  } else {
+    matches = _mm_or_si128(inRange(v, '\t', '\r'), _mm_cmpeq_epi16(v, _mm_set1_epi16(' ')));
+  }
+  const int mask = _mm_movemask_epi8(matches);
+  return (charClass == WordChars || charClass == BlankChars) ? mask : ~mask & 0xffff;
+}
+
+#endif
+
+int skipForward(const QChar *chars, int size, int from, CharClass charClass)
+{
+  int i = from;
+  while (i < size) {
+#ifdef EMACSMODE_SSE2
+    __m128i v;
+    if (i + ChunkSize <= size && loadAscii(chars + i, &v)) {
+      const int outside = ~classMask(v, charClass) & 0xffff;
+      if (outside)
+        return i + qCountTrailingZeroBits(quint32(outside)) / 2;
+      i += ChunkSize;
+      continue;
+    }
+    const int end = qMin(i + ChunkSize, size);
+#else
+    const int end = size;
+#endif
+    for (; i < end; ++i)
+      if (!isInClass(chars[i], charClass))
+        return i;
+  }
+  return size;
+}
+
+int skipBackward(const QChar *chars, int from, CharClass charClass)
+{
+  int i = from;
+  while (i > 0) {
+#ifdef EMACSMODE_SSE2
+    __m128i v;
+    if (i >= ChunkSize && loadAscii(chars + i - ChunkSize, &v)) {
+      const int outside = ~classMask(v, charClass) & 0xffff;
+      if (outside)
+        return i - ChunkSize + (31 - int(qCountLeadingZeroBits(quint32(outside)))) / 2 + 1;
+      i -= ChunkSize;
+      continue;
+    }
+    const int end = qMax(i - ChunkSize, 0);
+#else
+    const int end = 0;
+#endif
+    for (; i > end; --i)
+      if (!isInClass(chars[i - 1], charClass))
+        return i;
+  }
+  return 0;
+}
+
+bool isBlank(const QString &text)
+{
+  return skipForward(text.constData(), text.size(), 0, BlankChars) == text.size();
+}
+
+#ifdef EMACSMODE_SSE2
+
+// Two bits per character for the sixteen characters at chars that
+// equal needle, the first character in the lowest bits.
+static inline quint32 matchMask(const QChar *chars, __m128i needle)
+{
+  const __m128i *v = reinterpret_cast<const __m128i *>(chars);
+  const int low = _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_loadu_si128(v), needle));
+  const int high = _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_loadu_si128(v + 1), needle));
+  return quint32(low) | (quint32(high) << 16);
+}
+
+#endif
+
+int findForward(const QChar *chars, int size, int from, QChar c)
+{
+  int i = qMax(from, 0);
+#ifdef EMACSMODE_SSE2
+  const __m128i needle = _mm_set1_epi16(short(c.unicode()));
+  for (; i + 2 * ChunkSize <= size; i += 2 * ChunkSize) {
+    const quint32 mask = matchMask(chars + i, needle);
+    if (mask)
+      return i + qCountTrailingZeroBits(mask) / 2;
+  }
+#endif
+  for (; i < size; ++i)
+    if (chars[i] == c)
+      return i;
+  return -1;
+}
+
+int findBackward(const QChar *chars, int from, QChar c)
+{
+  int i = from;
+#ifdef EMACSMODE_SSE2
+  const __m128i needle = _mm_set1_epi16(short(c.unicode()));
+  for (; i >= 2 * ChunkSize; i -= 2 * ChunkSize) {
+    const quint32 mask = matchMask(chars + i - 2 * ChunkSize, needle);
+    if (mask)
+      return i - 2 * ChunkSize + (31 - int(qCountLeadingZeroBits(mask))) / 2;
+  }
+#endif
+  for (; i > 0; --i)
+    if (chars[i - 1] == c)
+      return i - 1;
+  return -1;
+}
+
+int firstNonBlank(const QString &text)
+{
+  return skipForward(text.constData(), text.size(), 0, BlankChars);
+}
+
+int lastNonBlank(const QString &text)
+{
+  return trailingWhitespaceStart(text) - 1;
+}
+
+int trailingWhitespaceStart(const QString &text)
+{
+  return skipBackward(text.constData(), text.size(), BlankChars);
+}
+
+static inline int nextColumn(int column, QChar c, int tabSize)
+{
+  return c == QLatin1Char('\t') ? (column / tabSize + 1) * tabSize : column + 1;
+}
+
+int columnAt(const QString &text, int index, int tabSize)
+{
+  index = qMin(index, text.size());
+  // without tabs columns are indexes, the common case needs one scan
+  int i = findForward(text.constData(), index, 0, QLatin1Char('\t'));
+  if (i == -1 || tabSize <= 0)
+    return index;
+
+  int column = i;
+  for (; i < index; ++i)
+    column = nextColumn(column, text.at(i), tabSize);
+  return column;
+}
+
+int indexAtColumn(const QString &text, int column, int tabSize)
+{
+  const int limit = qMin(qMax(column, 0), text.size());
+  int i = findForward(text.constData(), limit, 0, QLatin1Char('\t'));
+  if (i == -1 || tabSize <= 0)
+    return limit;
+
+  int current = i;
+  for (; i < text.size() && current < column; ++i)
+    current = nextColumn(current, text.at(i), tabSize);
+  return i;
+}
+
+int indentationWidth(const QString &text, int tabSize)
+{
+  return columnAt(text, firstNonBlank(text), tabSize);
+}
+
+}
+}
@@ -0,0 +1,76 @@
+/**************************************************************************
+**
+** Copyright (c) 2014 Siarhei Rachytski (siarhei.rachytski@gmail.com)
+**
+** GNU Lesser General Public License Usage
+**
+** This file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+
+#pragma once
+
+#include <QtCore/QChar>
+#include <QtCore/QString>
+
+namespace EmacsMode {
+namespace Internal {
+
+// Scanning kernels over UTF-16 text, e.g. QTextBlock::text().
+//
+// Runs of ASCII characters are classified eight at a time with SSE2
+// where available; any chunk containing other characters falls back to
+// the QChar Unicode tables.
+
+enum CharClass
+{
+  WordChars,   // letters, digits and '_'
+  NonWordChars,
+  BlankChars,  // white space
+  NonBlankChars
+};
+
+bool isWordChar(QChar c);
+bool isBlankChar(QChar c);
+bool isInClass(QChar c, CharClass charClass);
+
+// First index at or after from whose character is not in charClass,
+// size if there is none.
+int skipForward(const QChar *chars, int size, int from, CharClass charClass);
+// Smallest index such that all characters in [index, from) are in
+// charClass.
+int skipBackward(const QChar *chars, int from, CharClass charClass);
+
+bool isBlank(const QString &text);
+
+// Line helpers built on the kernels above, for block texts.
+
+// Index of the first non-blank character, size if the text is blank.
+int firstNonBlank(const QString &text);
+// Index of the last non-blank character, -1 if the text is blank.
+int lastNonBlank(const QString &text);
+// Start of the white space ending the text, size if there is none.
+int trailingWhitespaceStart(const QString &text);
+
+// Display column of index, tabs advance to the next multiple of tabSize.
+int columnAt(const QString &text, int index, int tabSize);
+// First index whose column is at least column, size if the text is
+// shorter. A tab spanning column is skipped.
+int indexAtColumn(const QString &text, int column, int tabSize);
+// Columns covered by the leading white space.
+int indentationWidth(const QString &text, int tabSize);
+
+// Index of the first c at or after from, -1 if there is none. Compares
+// sixteen characters per step with SSE2 regardless of their range.
+int findForward(const QChar *chars, int size, int from, QChar c);
+// Index of the last c before from, -1 if there is none.
+int findBackward(const QChar *chars, int from, QChar c);
+
+}
+}
@@ -0,0 +1,74 @@
+/**************************************************************************
+**
+** Copyright (c) 2014 Siarhei Rachytski (siarhei.rachytski@gmail.com)
+**
+** GNU Lesser General Public License Usage
+**
+** This file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+
+#include "whitespace.hpp"
+#include "textscan.hpp"
+
+namespace EmacsMode {
+namespace Internal {
+
+void whitespaceEdits(const QString &text, int position, int fixes, int tabSize,
+                     QVector<WhitespaceEdit> *edits)
+{
+  const QChar *chars = text.constData();
+  const QLatin1Char tab('\t');
+  const int end = (fixes & DeleteTrailingWhitespace) ? trailingWhitespaceStart(text) : text.size();
+  const int indentationEnd = qMin(firstNonBlank(text), end);
+  tabSize = qMax(tabSize, 1);
+
+  if (fixes & TabifyIndentation) {
+    // clean when it already is tabs followed by less than a tab of spaces
+    const int width = columnAt(text, indentationEnd, tabSize);
+    const int tabs = width / tabSize;
+    const int spaces = width % tabSize;
+    int i = 0;
+    while (i < indentationEnd && chars[i] == tab)
+      ++i;
+    const bool clean = i == tabs && indentationEnd - i == spaces
+        && findForward(chars, indentationEnd, i, tab) == -1;
+    if (!clean && indentationEnd > 0) {
+      QString indentation(tabs, tab);
+      indentation += QString(spaces, QLatin1Char(' '));
+      edits->append(WhitespaceEdit{position, position + indentationEnd, indentation});
+    }
+  } else if (fixes & (Untabify | UntabifyIndentation)) {
+    const int limit = (fixes & Untabify) ? end : indentationEnd;
+    const int first = findForward(chars, limit, 0, tab);
+    if (first != -1) {
+      const int last = findBackward(chars, limit, tab);
+      int column = columnAt(text, first, tabSize);
+      QString expanded;
+      expanded.reserve(last - first + tabSize);
+      for (int i = first; i <= last; ++i) {
+        if (chars[i] == tab) {
+          const int next = (column / tabSize + 1) * tabSize;
+          expanded += QString(next - column, QLatin1Char(' '));
+          column = next;
+        } else {
+          expanded += chars[i];
+          ++column;
+        }
+      }
+      edits->append(WhitespaceEdit{position + first, position + last + 1, expanded});
+    }
+  }
+
+  if (end < text.size())
+    edits->append(WhitespaceEdit{position + end, position + text.size(), QString()});
+}
+
+}
+}
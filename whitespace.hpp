@@ -0,0 +1,48 @@
+/**************************************************************************
+**
+** Copyright (c) 2014 Siarhei Rachytski (siarhei.rachytski@gmail.com)
+**
+** GNU Lesser General Public License Usage
+**
+** This file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+
+#pragma once
+
+#include <QtCore/QString>
+#include <QtCore/QVector>
+
+namespace EmacsMode {
+namespace Internal {
+
+enum WhitespaceFix
+{
+  DeleteTrailingWhitespace = 0x1,
+  Untabify = 0x2,            // every tab on the line becomes spaces
+  UntabifyIndentation = 0x4, // only tabs in the leading white space
+  TabifyIndentation = 0x8    // leading white space becomes tabs, then spaces
+};
+
+// Replacement of the document range [begin_, end_) by text_.
+struct WhitespaceEdit
+{
+  int begin_;
+  int end_;
+  QString text_;
+};
+
+// Appends the edits the fixes need on one line to edits, in document
+// order. position is where text starts in the document. A line that is
+// already clean is scanned but nothing is allocated for it.
+void whitespaceEdits(const QString &text, int position, int fixes, int tabSize,
+                     QVector<WhitespaceEdit> *edits);
+
+}
+}
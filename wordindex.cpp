@@ -0,0 +1,295 @@
+/**************************************************************************
+**
+** Copyright (c) 2014 Siarhei Rachytski (siarhei.rachytski@gmail.com)
+**
+** GNU Lesser General Public License Usage
+**
+** This file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+
+#include "wordindex.hpp"
+#include "blockchange.hpp"
+#include "symboldictionary.hpp"
+#include "textscan.hpp"
+
+#include <QtCore/QSet>
+#include <QtCore/QVector>
+#include <QtGui/QTextBlock>
+#include <QtGui/QTextDocument>
+
+#include <algorithm>
+#include <iterator>
+
+namespace EmacsMode {
+namespace Internal {
+
+// Single letters are not worth completing, very long tokens are usually
+// encoded blobs.
+static const int MinWordLength = 2;
+static const int MaxWordLength = 128;
+
+template <typename Function>
+static void forEachWord(const QString &text, Function fn)
+{
+  const QChar *chars = text.constData();
+  const int size = text.size();
+  int i = 0;
+  while (i < size) {
+    i = skipForward(chars, size, i, NonWordChars);
+    const int start = i;
+    i = skipForward(chars, size, i, WordChars);
+    const int length = i - start;
+    if (length >= MinWordLength && length <= MaxWordLength)
+      fn(start, length);
+  }
+}
+
+QStringList wordsOf(const QString &text)
+{
+  QStringList words;
+  forEachWord(text, [&](int start, int length) {
+    words.append(text.mid(start, length));
+  });
+  return words;
+}
+
+WordIndex::WordIndex()
+{}
+
+WordIndex::~WordIndex()
+{
+  clear();
+}
+
+void WordIndex::setDocument(QTextDocument *document)
+{
+  clear();
+  document_ = document;
+}
+
+void WordIndex::setDictionary(SymbolDictionary *dictionary)
+{
+  clear();
+  dictionary_ = dictionary;
+}
+
+void WordIndex::ensureBuilt()
+{
+  if (!built_)
+    build();
+}
+
+void WordIndex::clear()
+{
+  if (dictionary_)
+    for (int id : sorted_)
+      dictionary_->unref(words_[id], built_ ? counts_[id] : 0);
+
+  built_ = false;
+  blockWords_.clear();
+  words_.clear();
+  counts_.clear();
+  freeIds_.clear();
+  sorted_.clear();
+  ids_.clear();
+}
+
+void WordIndex::build()
+{
+  clear();
+  if (!document_)
+    return;
+
+  blockWords_.resize(document_->blockCount());
+  int i = 0;
+  building_ = true;
+  for (QTextBlock block = document_->begin(); block.isValid(); block = block.next())
+    tokenize(block.text(), &blockWords_[i++]);
+  building_ = false;
+  std::sort(sorted_.begin(), sorted_.end(),
+            [this](int a, int b) { return words_[a] < words_[b]; });
+  // one lookup per distinct word rather than per occurrence
+  if (dictionary_)
+    for (int id : sorted_)
+      dictionary_->addOccurrences(words_[id], counts_[id]);
+  built_ = true;
+}
+
+void WordIndex::update(const BlockChange &change)
+{
+  if (!built_)
+    return;
+
+  if (!change.isValid()
+      || change.firstBlock_ + change.removedBlocks_ > int(blockWords_.size())) {
+    clear();
+    return;
+  }
+
+  // Acquire the new words before releasing the old ones, so words that
+  // merely moved keep their ids.
+  std::vector<std::vector<int> > added(change.addedBlocks_);
+  QTextBlock block = document_->findBlockByNumber(change.firstBlock_);
+  updating_ = true;
+  for (int i = 0; i < change.addedBlocks_ && block.isValid(); ++i, block = block.next())
+    tokenize(block.text(), &added[i]);
+  updating_ = false;
+
+  const auto first = blockWords_.begin() + change.firstBlock_;
+  for (auto it = first; it != first + change.removedBlocks_; ++it)
+    for (int id : *it)
+      release(id);
+
+  const int common = qMin(change.removedBlocks_, change.addedBlocks_);
+  for (int i = 0; i < common; ++i)
+    blockWords_[change.firstBlock_ + i].swap(added[i]);
+  if (change.removedBlocks_ > common)
+    blockWords_.erase(first + common, first + change.removedBlocks_);
+  else
+    blockWords_.insert(first + common,
+                       std::make_move_iterator(added.begin() + common),
+                       std::make_move_iterator(added.end()));
+
+  if (int(blockWords_.size()) != document_->blockCount())
+    clear();
+}
+
+QStringList WordIndex::completions(const QString &prefix, int position)
+{
+  QStringList result;
+  ensureBuilt();
+  if (!built_)
+    return result;
+
+  QSet<int> candidates;
+  for (auto it = lowerBound(prefix); it != sorted_.end() && words_[*it].startsWith(prefix); ++it)
+    if (words_[*it].size() > prefix.size())
+      candidates.insert(*it);
+
+  // true once every candidate has been placed
+  auto take = [&](int id) {
+    if (candidates.remove(id))
+      result.append(words_[id]);
+    return candidates.isEmpty();
+  };
+
+  if (candidates.isEmpty())
+    return result;
+
+  // Cached ids carry no columns, so the current block is split at the
+  // word being completed by scanning its text once.
+  const QTextBlock current = document_->findBlock(position);
+  const int currentBlock = current.blockNumber();
+  const int wordStart = position - current.position() - prefix.size();
+  const QString text = current.text();
+  QVector<int> before;
+  QVector<int> after;
+  forEachWord(text, [&](int start, int length) {
+    if (start == wordStart)
+      return;
+    const auto id = ids_.constFind(QString::fromRawData(text.constData() + start, length));
+    if (id != ids_.constEnd())
+      (start < wordStart ? before : after).append(*id);
+  });
+
+  for (int i = before.size() - 1; i >= 0; --i)
+    if (take(before.at(i)))
+      return result;
+  for (int b = currentBlock - 1; b >= 0; --b)
+    for (auto it = blockWords_[b].rbegin(); it != blockWords_[b].rend(); ++it)
+      if (take(*it))
+        return result;
+  for (int id : after)
+    if (take(id))
+      return result;
+  for (int b = currentBlock + 1; b < int(blockWords_.size()); ++b)
+    for (int id : blockWords_[b])
+      if (take(id))
+        return result;
+
+  return result;
+}
+
+QStringList WordIndex::wordsWithPrefix(const QString &prefix)
+{
+  QStringList result;
+  ensureBuilt();
+  for (auto it = lowerBound(prefix); it != sorted_.end() && words_[*it].startsWith(prefix); ++it)
+    result.append(words_[*it]);
+  return result;
+}
+
+void WordIndex::tokenize(const QString &text, std::vector<int> *ids)
+{
+  forEachWord(text, [&](int start, int length) {
+    ids->push_back(acquire(QString::fromRawData(text.constData() + start, length)));
+  });
+}
+
+int WordIndex::acquire(const QString &word)
+{
+  const auto found = ids_.constFind(word);
+  if (found != ids_.constEnd()) {
+    ++counts_[*found];
+    if (dictionary_ && !building_)
+      dictionary_->addOccurrences(words_[*found], 1);
+    return *found;
+  }
+
+  // word may point into a block's text, keep a deep copy
+  const QString copy = dictionary_ ? dictionary_->ref(word) : QString(word.constData(), word.size());
+  if (dictionary_ && !building_)
+    dictionary_->addOccurrences(copy, 1);
+  // typed rather than loaded, rank it as recently used
+  if (dictionary_ && updating_)
+    dictionary_->touch(copy);
+  int id;
+  if (!freeIds_.empty()) {
+    id = freeIds_.back();
+    freeIds_.pop_back();
+    words_[id] = copy;
+    counts_[id] = 1;
+  } else {
+    id = int(words_.size());
+    words_.push_back(copy);
+    counts_.push_back(1);
+  }
+  ids_.insert(copy, id);
+  if (building_)
+    sorted_.push_back(id);
+  else
+    sorted_.insert(lowerBound(copy), id);
+  return id;
+}
+
+void WordIndex::release(int id)
+{
+  if (--counts_[id] > 0) {
+    if (dictionary_)
+      dictionary_->addOccurrences(words_[id], -1);
+    return;
+  }
+
+  sorted_.erase(lowerBound(words_[id]));
+  if (dictionary_)
+    dictionary_->unref(words_[id], 1);
+  ids_.remove(words_[id]);
+  words_[id].clear();
+  freeIds_.push_back(id);
+}
+
+std::vector<int>::iterator WordIndex::lowerBound(const QString &word)
+{
+  return std::lower_bound(sorted_.begin(), sorted_.end(), word,
+                          [this](int id, const QString &w) { return words_[id] < w; });
+}
+
+}
+}
@@ -0,0 +1,82 @@
+/**************************************************************************
+**
+** Copyright (c) 2014 Siarhei Rachytski (siarhei.rachytski@gmail.com)
+**
+** GNU Lesser General Public License Usage
+**
+** This file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL included in the
+** packaging of this file.  Please review the following information to
+** ensure the GNU Lesser General Public License version 2.1 requirements
+** will be met: http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+**************************************************************************/
+
+
+#pragma once
+
+#include <QtCore/QHash>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+
+#include <vector>
+
+class QTextDocument;
+
+namespace EmacsMode {
+namespace Internal {
+
+struct BlockChange;
+class SymbolDictionary;
+
+QStringList wordsOf(const QString &text);
+
+// Words of a single document, kept up to date block by block.
+//
+// Every block stores the ids of its words in order of appearance, so a
+// completion request walks integer vectors instead of document text and
+// an edit only retokenizes the blocks it touched. The index is built on
+// first use. With a SymbolDictionary attached, words are interned there
+// and referenced once per index.
+class WordIndex
+{
+public:
+  WordIndex();
+  ~WordIndex();
+
+  void setDocument(QTextDocument *document);
+  void setDictionary(SymbolDictionary *dictionary);
+  void ensureBuilt();
+  void clear();
+  void update(const BlockChange &change);
+
+  // Distinct words starting with prefix, nearest occurrence before
+  // position first, then the ones after it.
+  QStringList completions(const QString &prefix, int position);
+  // Distinct words starting with prefix in alphabetical order.
+  QStringList wordsWithPrefix(const QString &prefix);
+
+private:
+  void build();
+  void tokenize(const QString &text, std::vector<int> *ids);
+  int acquire(const QString &word);
+  void release(int id);
+  std::vector<int>::iterator lowerBound(const QString &word);
+
+  QTextDocument *document_ = nullptr;
+  SymbolDictionary *dictionary_ = nullptr;
+  bool built_ = false;
+  bool updating_ = false;
+  bool building_ = false; // sorted_ is sorted once build() is done
+
+  std::vector<std::vector<int> > blockWords_; // block number -> word ids
+  std::vector<QString> words_;                // id -> word
+  std::vector<int> counts_;                   // id -> occurrences
+  std::vector<int> freeIds_;
+  std::vector<int> sorted_;                   // live ids ordered by word
+  QHash<QString, int> ids_;                   // word -> id
+};
+
+}
+}